@@ -0,0 +1,43 @@
+#ifndef _BENCH_H_
+#define _BENCH_H_
+
+/**
+ * 各个压力测试和性能测试共用的小工具
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+
+/**
+ * 单调时钟，单位为纳秒
+ */
+static inline uint64_t bench_now_ns(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/**
+ * xorshift64，每个线程一个状态，不用rand()的全局锁
+ */
+static inline uint64_t bench_rand(uint64_t *s) {
+	uint64_t x = *s;
+
+	x ^= x << 13;
+	x ^= x >> 7;
+	x ^= x << 17;
+
+	return *s = x;
+}
+
+/**
+ * 取第i个命令行参数，没有时用默认值
+ */
+static inline unsigned long bench_arg(int argc, char **argv, int i, unsigned long def) {
+	return argc > i ? strtoul(argv[i], NULL, 0) : def;
+}
+
+#endif
@@ -0,0 +1,172 @@
+
+/**
+ * bitset_atomic的争用测试
+ *
+ * 多个线程反复分配和释放槽位，每个线程手里同时持有HOLD个，
+ * 比较三种做法:
+ *
+ *  mutex  普通bitset加一把锁，bitset_find_first_clear之后置位
+ *  shared bitset_atomic_claim_first_clear，所有线程共用一个hint
+ *  hint   bitset_atomic_claim_first_clear_hint，每个线程自己的hint
+ *
+ * 同时检查正确性:每个槽位另有一个owner标志，分配到时必须为0，
+ * 释放时test_and_clear必须返回1，否则说明同一个槽位被分配了两次。
+ * 用make tsan编译可以在ThreadSanitizer下运行
+ *
+ *	bitset_atomic_bench [线程数 [槽位数 [每个线程的次数]]]
+ */
+
+#include "bitset.h"
+#include "bitset_atomic.h"
+#include "bench.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdatomic.h>
+
+#define HOLD 16
+
+typedef enum { MODE_MUTEX, MODE_SHARED, MODE_HINT } bench_mode;
+
+static const char *mode_names[] = { "mutex", "shared", "hint" };
+
+static bench_mode mode;
+static unsigned long nthreads, nslots, iters;
+
+static bitset_atomic *aset;
+static bitset *mset;
+static pthread_mutex_t mlock = PTHREAD_MUTEX_INITIALIZER;
+
+static atomic_char *owner;
+static atomic_ulong errors;
+static atomic_ulong full;
+
+static size_t claim(size_t *hint) {
+	size_t pos;
+
+	switch (mode) {
+	case MODE_MUTEX:
+		pthread_mutex_lock(&mlock);
+		pos = bitset_find_first_clear(mset);
+		if (pos < nslots) bitset_set_bit(mset, pos);
+		pthread_mutex_unlock(&mlock);
+		return pos < nslots ? pos : nslots;
+	case MODE_SHARED:
+		return bitset_atomic_claim_first_clear(aset);
+	case MODE_HINT:
+		return bitset_atomic_claim_first_clear_hint(aset, hint);
+	}
+
+	return nslots;
+}
+
+static int release(size_t pos) {
+	int was;
+
+	if (mode == MODE_MUTEX) {
+		pthread_mutex_lock(&mlock);
+		was = bitset_test_bit(mset, pos);
+		bitset_clear_bit(mset, pos);
+		pthread_mutex_unlock(&mlock);
+		return was;
+	}
+
+	return bitset_atomic_test_and_clear(aset, pos);
+}
+
+static void *worker(void *arg) {
+	size_t id = (size_t)arg;
+	size_t held[HOLD], hint, pos;
+	unsigned long i, n = 0;
+
+	hint = id * BITSET_USED(nslots) / nthreads;
+
+	for (i = 0; i < iters; i++) {
+		/* 手里满了先还掉最早的一个 */
+		if (n == HOLD) {
+			pos = held[i % HOLD];
+			atomic_store(&owner[pos], 0);
+			if (!release(pos)) atomic_fetch_add(&errors, 1);
+			n--;
+		}
+
+		pos = claim(&hint);
+		if (pos >= nslots) {
+			atomic_fetch_add(&full, 1);
+			continue;
+		}
+		if (atomic_exchange(&owner[pos], 1)) atomic_fetch_add(&errors, 1);
+
+		held[i % HOLD] = pos;
+		n++;
+	}
+
+	/* 还掉剩下的，held中没有用到的格子不会被访问 */
+	for (i = iters; n > 0; i++, n--) {
+		pos = held[i % HOLD];
+		atomic_store(&owner[pos], 0);
+		if (!release(pos)) atomic_fetch_add(&errors, 1);
+	}
+
+	return NULL;
+}
+
+int main(int argc, char **argv) {
+	pthread_t *tids;
+	unsigned long i;
+	uint64_t start, ns;
+	int ret = 0;
+
+	nthreads = bench_arg(argc, argv, 1, 4);
+	nslots = bench_arg(argc, argv, 2, 4096);
+	iters = bench_arg(argc, argv, 3, 1000000);
+
+	/* 槽位必须够每个线程持有HOLD个，否则只是在测分配失败 */
+	if (nthreads == 0 || nslots < nthreads * HOLD) {
+		fprintf(stderr, "need at least %d slots per thread\n", HOLD);
+		return 2;
+	}
+
+	tids = malloc(nthreads * sizeof(*tids));
+	owner = calloc(nslots, sizeof(*owner));
+
+	printf("threads=%lu slots=%lu iters/thread=%lu hold=%d\n", nthreads, nslots, iters, HOLD);
+
+	for (mode = MODE_MUTEX; mode <= MODE_HINT; mode++) {
+		aset = bitset_atomic_init(nslots);
+		mset = bitset_init(nslots);
+		atomic_store(&errors, 0);
+		atomic_store(&full, 0);
+
+		start = bench_now_ns();
+		for (i = 0; i < nthreads; i++) pthread_create(&tids[i], NULL, worker, (void *)(size_t)i);
+		for (i = 0; i < nthreads; i++) pthread_join(tids[i], NULL);
+		ns = bench_now_ns() - start;
+
+		printf("%-6s %8.2f Mclaims/s  %6.1f ns/claim  errors=%lu full=%lu\n",
+			mode_names[mode],
+			(double)nthreads * iters / ns * 1000,
+			(double)ns / iters,
+			(unsigned long)atomic_load(&errors),
+			(unsigned long)atomic_load(&full));
+
+		if (atomic_load(&errors)) ret = 1;
+
+		/* 全部还掉之后应该一个都不剩 */
+		for (i = 0; i < nslots; i++) {
+			if (mode == MODE_MUTEX ? bitset_test_bit(mset, i) : bitset_atomic_test_bit(aset, i)) {
+				printf("%-6s slot %lu still set\n", mode_names[mode], i);
+				ret = 1;
+				break;
+			}
+		}
+
+		bitset_atomic_free(aset);
+		bitset_free(mset);
+	}
+
+	free(owner);
+	free(tids);
+
+	return ret;
+}
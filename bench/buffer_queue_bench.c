@@ -0,0 +1,234 @@
+
+/**
+ * buffer_queue的吞吐量和延迟测试
+ *
+ * 吞吐量:P个生产者和C个消费者，比较三种做法:
+ *
+ *  mutex  一把锁保护的环形数组
+ *  single buffer_queue_push/buffer_queue_pop，一次一个
+ *  batch  buffer_queue_push_batch/buffer_queue_pop_batch，一次BATCH个
+ *
+ * 延迟:两个线程通过两个队列来回传一个buffer，统计往返时间的
+ * 中位数、99%和最大值。队列空时sched_yield，单核的机器上
+ * 测到的主要是线程切换的时间
+ *
+ *	buffer_queue_bench [生产者数 [消费者数 [每个生产者的个数 [队列大小 [往返次数]]]]]
+ */
+
+#include "buffer_queue.h"
+#include "bench.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+
+#define BATCH 16
+
+typedef enum { MODE_MUTEX, MODE_SINGLE, MODE_BATCH } bench_mode;
+
+static const char *mode_names[] = { "mutex", "single", "batch" };
+
+static bench_mode mode;
+static unsigned long nprod, ncons, per_prod, qsize, rounds;
+
+static buffer_queue *q;
+static atomic_ulong consumed;
+
+/* mutex做法的环形数组 */
+static pthread_mutex_t mlock = PTHREAD_MUTEX_INITIALIZER;
+static buffer **ring;
+static size_t ring_head, ring_used;
+
+static size_t mutex_push(buffer **bs, size_t n) {
+	size_t i;
+
+	pthread_mutex_lock(&mlock);
+	for (i = 0; i < n && ring_used < qsize; i++, ring_used++) {
+		ring[(ring_head + ring_used) % qsize] = bs[i];
+	}
+	pthread_mutex_unlock(&mlock);
+
+	return i;
+}
+
+static size_t mutex_pop(buffer **bs, size_t max) {
+	size_t i;
+
+	pthread_mutex_lock(&mlock);
+	for (i = 0; i < max && ring_used > 0; i++, ring_used--) {
+		bs[i] = ring[ring_head];
+		ring_head = (ring_head + 1) % qsize;
+	}
+	pthread_mutex_unlock(&mlock);
+
+	return i;
+}
+
+/**
+ * 生产者反复放入同一组buffer，消费者只计数不访问，
+ * 测的只是队列本身
+ */
+static void *producer(void *arg) {
+	buffer *bs[BATCH];
+	unsigned long i = 0;
+	size_t n, k;
+
+	for (k = 0; k < BATCH; k++) bs[k] = arg;
+
+	while (i < per_prod) {
+		n = per_prod - i < BATCH ? per_prod - i : BATCH;
+
+		switch (mode) {
+		case MODE_MUTEX:
+			n = mutex_push(bs, 1);
+			break;
+		case MODE_SINGLE:
+			n = (0 == buffer_queue_push(q, bs[0]));
+			break;
+		case MODE_BATCH:
+			n = buffer_queue_push_batch(q, bs, n);
+			break;
+		}
+
+		if (n == 0) sched_yield();
+		i += n;
+	}
+
+	return NULL;
+}
+
+static void *consumer(void *arg) {
+	buffer *bs[BATCH];
+	size_t n;
+
+	UNUSED(arg);
+
+	while (atomic_load_explicit(&consumed, memory_order_relaxed) < nprod * per_prod) {
+		switch (mode) {
+		case MODE_MUTEX:
+			n = mutex_pop(bs, 1);
+			break;
+		case MODE_SINGLE:
+			n = (NULL != buffer_queue_pop(q));
+			break;
+		case MODE_BATCH:
+		default:
+			n = buffer_queue_pop_batch(q, bs, BATCH);
+			break;
+		}
+
+		if (n == 0) {
+			sched_yield();
+			continue;
+		}
+		atomic_fetch_add_explicit(&consumed, n, memory_order_relaxed);
+	}
+
+	return NULL;
+}
+
+static void throughput(void) {
+	pthread_t *tids = malloc((nprod + ncons) * sizeof(*tids));
+	buffer *b = buffer_init();
+	uint64_t start, ns;
+	unsigned long i;
+
+	ring = malloc(qsize * sizeof(*ring));
+
+	for (mode = MODE_MUTEX; mode <= MODE_BATCH; mode++) {
+		q = buffer_queue_init(qsize, 0);
+		ring_head = ring_used = 0;
+		atomic_store(&consumed, 0);
+
+		start = bench_now_ns();
+		for (i = 0; i < nprod; i++) pthread_create(&tids[i], NULL, producer, b);
+		for (i = 0; i < ncons; i++) pthread_create(&tids[nprod + i], NULL, consumer, NULL);
+		for (i = 0; i < nprod + ncons; i++) pthread_join(tids[i], NULL);
+		ns = bench_now_ns() - start;
+
+		printf("%-6s %8.2f Mops/s  %6.1f ns/op\n",
+			mode_names[mode],
+			(double)nprod * per_prod / ns * 1000,
+			(double)ns / (nprod * per_prod));
+
+		/* 队列中是同一个buffer的多个引用，不能让buffer_queue_free释放 */
+		while (buffer_queue_pop(q));
+		buffer_queue_free(q);
+	}
+
+	free(ring);
+	buffer_free(b);
+	free(tids);
+}
+
+static buffer_queue *ping, *pong;
+
+static void *echo(void *arg) {
+	buffer *b;
+	unsigned long i;
+
+	UNUSED(arg);
+
+	for (i = 0; i < rounds; i++) {
+		while (NULL == (b = buffer_queue_pop(ping))) sched_yield();
+		while (0 != buffer_queue_push(pong, b)) sched_yield();
+	}
+
+	return NULL;
+}
+
+static int cmp_u64(const void *a, const void *b) {
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static void latency(void) {
+	pthread_t tid;
+	buffer *b = buffer_init(), *r;
+	uint64_t *rtt = malloc(rounds * sizeof(*rtt)), start;
+	unsigned long i;
+
+	ping = buffer_queue_init(qsize, 0);
+	pong = buffer_queue_init(qsize, 0);
+
+	pthread_create(&tid, NULL, echo, NULL);
+
+	for (i = 0; i < rounds; i++) {
+		start = bench_now_ns();
+		while (0 != buffer_queue_push(ping, b)) sched_yield();
+		while (NULL == (r = buffer_queue_pop(pong))) sched_yield();
+		rtt[i] = bench_now_ns() - start;
+	}
+
+	pthread_join(tid, NULL);
+
+	qsort(rtt, rounds, sizeof(*rtt), cmp_u64);
+	printf("rtt    p50=%.2f us  p99=%.2f us  max=%.2f us  (%lu round trips)\n",
+		rtt[rounds / 2] / 1000.0, rtt[rounds * 99 / 100] / 1000.0, rtt[rounds - 1] / 1000.0, rounds);
+
+	buffer_queue_free(ping);
+	buffer_queue_free(pong);
+	buffer_free(b);
+	free(rtt);
+}
+
+int main(int argc, char **argv) {
+	nprod = bench_arg(argc, argv, 1, 4);
+	ncons = bench_arg(argc, argv, 2, 4);
+	per_prod = bench_arg(argc, argv, 3, 1000000);
+	qsize = bench_arg(argc, argv, 4, 1024);
+	rounds = bench_arg(argc, argv, 5, 100000);
+
+	if (nprod == 0 || ncons == 0 || qsize == 0 || rounds == 0) {
+		fprintf(stderr, "need producers, consumers, a queue and round trips\n");
+		return 2;
+	}
+
+	printf("producers=%lu consumers=%lu items/producer=%lu queue=%lu\n", nprod, ncons, per_prod, qsize);
+
+	throughput();
+	latency();
+
+	return 0;
+}
@@ -0,0 +1,232 @@
+
+/**
+ * buffer_queue的多线程正确性测试
+ *
+ * 第一部分:P个生产者和C个消费者同时放入和取出，单个和成批混用。
+ * 每个buffer的内容是(生产者, 序号)，检查
+ *
+ *  - 每个buffer正好被取出一次，没有丢失也没有重复
+ *  - 同一个消费者看到的同一个生产者的序号是递增的(队列是FIFO)
+ *
+ * 第二部分:P个生产者和一个消费者，消费者用poll等待通知的fd，
+ * 按buffer_queue_clear_notify的要求取到空为止。超过一秒没有
+ * 通知而还有buffer没取到，说明通知丢了
+ *
+ * 用make tsan编译可以在ThreadSanitizer下运行
+ *
+ *	buffer_queue_stress [生产者数 [消费者数 [每个生产者的个数 [队列大小]]]]
+ */
+
+#include "buffer_queue.h"
+#include "bench.h"
+
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <string.h>
+
+#define BATCH 8
+
+typedef struct {
+	uint32_t producer;
+	uint32_t seq;
+} stress_item;
+
+static buffer_queue *q;
+static unsigned long nprod, ncons, per_prod, qsize;
+
+static atomic_uchar *seen;         /* 每个(生产者, 序号)被取出的次数 */
+static atomic_ulong consumed;
+static atomic_ulong errors;
+
+static void *producer(void *arg) {
+	uint32_t id = (uint32_t)(size_t)arg;
+	uint64_t rng = 0x9e3779b97f4a7c15ULL * (id + 1);
+	buffer *bs[BATCH];
+	stress_item it;
+	unsigned long i = 0;
+	size_t n, k, done;
+
+	while (i < per_prod) {
+		/* 一半的时候成批放入 */
+		n = (bench_rand(&rng) & 1) ? 1 + bench_rand(&rng) % BATCH : 1;
+		if (n > per_prod - i) n = per_prod - i;
+
+		for (k = 0; k < n; k++) {
+			it.producer = id;
+			it.seq = i + k;
+			bs[k] = buffer_init();
+			buffer_copy_string_len(bs[k], (const char *)&it, sizeof(it));
+		}
+
+		for (done = 0; done < n; ) {
+			if (n == 1) {
+				if (0 == buffer_queue_push(q, bs[0])) done = 1;
+			} else {
+				done += buffer_queue_push_batch(q, bs + done, n - done);
+			}
+			if (done < n) sched_yield();
+		}
+
+		i += n;
+	}
+
+	return NULL;
+}
+
+/**
+ * 检查取出的一个buffer，last是这个消费者看到的每个生产者的上一个序号加1
+ */
+static void check(buffer *b, unsigned long *last) {
+	stress_item it;
+
+	if (b->used != sizeof(it) + 1) {
+		atomic_fetch_add(&errors, 1);
+		buffer_free(b);
+		return;
+	}
+	memcpy(&it, b->ptr, sizeof(it));
+	buffer_free(b);
+
+	if (it.producer >= nprod || it.seq >= per_prod) {
+		atomic_fetch_add(&errors, 1);
+		return;
+	}
+	if (atomic_fetch_add(&seen[it.producer * per_prod + it.seq], 1) != 0) {
+		printf("producer %u seq %u consumed twice\n", it.producer, it.seq);
+		atomic_fetch_add(&errors, 1);
+	}
+	if (it.seq < last[it.producer]) {
+		printf("producer %u seq %u after %lu\n", it.producer, it.seq, last[it.producer] - 1);
+		atomic_fetch_add(&errors, 1);
+	}
+	last[it.producer] = it.seq + 1;
+
+	atomic_fetch_add(&consumed, 1);
+}
+
+static void *consumer(void *arg) {
+	uint64_t rng = 0xbf58476d1ce4e5b9ULL * ((size_t)arg + 1);
+	unsigned long *last = calloc(nprod, sizeof(*last));
+	buffer *bs[BATCH], *b;
+	size_t n, k;
+
+	while (atomic_load(&consumed) < nprod * per_prod) {
+		if (bench_rand(&rng) & 1) {
+			n = buffer_queue_pop_batch(q, bs, 1 + bench_rand(&rng) % BATCH);
+			for (k = 0; k < n; k++) check(bs[k], last);
+		} else if (NULL != (b = buffer_queue_pop(q))) {
+			n = 1;
+			check(b, last);
+		} else {
+			n = 0;
+		}
+		if (n == 0) sched_yield();
+	}
+
+	free(last);
+	return NULL;
+}
+
+/**
+ * 第二部分的消费者，在主线程中运行
+ */
+static void notify_consumer(void) {
+	unsigned long *last = calloc(nprod, sizeof(*last));
+	struct pollfd pfd;
+	buffer *bs[BATCH];
+	size_t n, k;
+	int lost = 0;
+
+	pfd.fd = buffer_queue_get_fd(q);
+	pfd.events = POLLIN;
+
+	while (atomic_load(&consumed) < nprod * per_prod) {
+		/* 通知丢了之后不再等，照样取完，生产者才不会卡在满的队列上 */
+		if (poll(&pfd, 1, lost ? 0 : 1000) == 0 && !lost) {
+			printf("no notification for 1s, %lu of %lu consumed\n",
+				(unsigned long)atomic_load(&consumed), nprod * per_prod);
+			atomic_fetch_add(&errors, 1);
+			lost = 1;
+		}
+
+		buffer_queue_clear_notify(q);
+		while (0 != (n = buffer_queue_pop_batch(q, bs, BATCH))) {
+			for (k = 0; k < n; k++) check(bs[k], last);
+		}
+	}
+
+	free(last);
+}
+
+static int verify(const char *name) {
+	unsigned long i, missing = 0;
+
+	for (i = 0; i < nprod * per_prod; i++) {
+		if (atomic_load(&seen[i]) != 1) missing++;
+	}
+
+	printf("%-7s producers=%lu consumers=%lu items=%lu missing=%lu errors=%lu\n",
+		name, nprod, ncons, nprod * per_prod, missing, (unsigned long)atomic_load(&errors));
+
+	return missing || atomic_load(&errors) ? 1 : 0;
+}
+
+static void reset(int notify) {
+	unsigned long i;
+
+	q = buffer_queue_init(qsize, notify);
+	for (i = 0; i < nprod * per_prod; i++) atomic_store(&seen[i], 0);
+	atomic_store(&consumed, 0);
+	atomic_store(&errors, 0);
+}
+
+int main(int argc, char **argv) {
+	pthread_t *tids;
+	unsigned long i;
+	int ret = 0;
+
+	nprod = bench_arg(argc, argv, 1, 4);
+	ncons = bench_arg(argc, argv, 2, 4);
+	per_prod = bench_arg(argc, argv, 3, 200000);
+	qsize = bench_arg(argc, argv, 4, 64);
+
+	if (nprod == 0 || ncons == 0 || per_prod == 0 || per_prod > UINT32_MAX) {
+		fprintf(stderr, "need producers, consumers and items\n");
+		return 2;
+	}
+
+	/* 太大的队列应该被拒绝，而不是卡在取2的幂的循环里 */
+	if (NULL != buffer_queue_init(SIZE_MAX, 0)) {
+		printf("oversized queue accepted\n");
+		ret = 1;
+	}
+
+	tids = malloc((nprod + ncons) * sizeof(*tids));
+	seen = malloc(nprod * per_prod * sizeof(*seen));
+
+	reset(0);
+	for (i = 0; i < nprod; i++) pthread_create(&tids[i], NULL, producer, (void *)(size_t)i);
+	for (i = 0; i < ncons; i++) pthread_create(&tids[nprod + i], NULL, consumer, (void *)(size_t)i);
+	for (i = 0; i < nprod + ncons; i++) pthread_join(tids[i], NULL);
+	ret |= verify("spin");
+	buffer_queue_free(q);
+
+	reset(1);
+	if (q == NULL) {
+		printf("cannot create the notify fd\n");
+		return 1;
+	}
+	ncons = 1;
+	for (i = 0; i < nprod; i++) pthread_create(&tids[i], NULL, producer, (void *)(size_t)i);
+	notify_consumer();
+	for (i = 0; i < nprod; i++) pthread_join(tids[i], NULL);
+	ret |= verify("notify");
+	buffer_queue_free(q);
+
+	free(seen);
+	free(tids);
+
+	return ret;
+}
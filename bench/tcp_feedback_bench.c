@@ -0,0 +1,196 @@
+
+/**
+ * network_write_budget在回环连接上的测试
+ *
+ * 发送方用非阻塞socket和poll写出一定量的数据，接收方线程
+ * 每次读固定的字节数，比较三种做法:
+ *
+ *  fixed     每次都写满上限，不看内核的状态
+ *  per_write 每次写之前都取一次内核的状态
+ *  per_pass  每次可写事件只取一次，额度在这次的多次写之间扣减
+ *
+ * 输出耗时、poll、write和取状态的次数，以及写不下(EAGAIN)的次数。
+ * 取一次状态是两次系统调用(TCP_INFO和SIOCOUTQNSD)。后两种做法
+ * 和服务器中一样设置TCP_NOTSENT_LOWAT，为0时不设置
+ *
+ *	tcp_feedback_bench [MB [接收方每次读的字节数 [写的上限 [lowat]]]]
+ */
+
+#include "network_backends.h"
+#include "bench.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+typedef enum { MODE_FIXED, MODE_PER_WRITE, MODE_PER_PASS } bench_mode;
+
+static const char *mode_names[] = { "fixed", "per_write", "per_pass" };
+
+static unsigned long total, rdsize, limit, lowat;
+
+static void *receiver(void *arg) {
+	int fd = (int)(size_t)arg;
+	char *buf = malloc(rdsize);
+	unsigned long got = 0;
+	ssize_t n;
+
+	while (got < total) {
+		n = read(fd, buf, rdsize);
+		if (n <= 0) break;
+		got += n;
+	}
+
+	free(buf);
+	return (void *)(size_t)(got == total);
+}
+
+/**
+ * 建立一对回环上的TCP连接
+ */
+static int bench_connect(int *wfd, int *rfd) {
+	struct sockaddr_in addr;
+	socklen_t len = sizeof(addr);
+	int lfd;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	if (-1 == (lfd = socket(AF_INET, SOCK_STREAM, 0))) return -1;
+	if (0 != bind(lfd, (struct sockaddr *)&addr, sizeof(addr)) ||
+	    0 != listen(lfd, 1) ||
+	    0 != getsockname(lfd, (struct sockaddr *)&addr, &len)) {
+		close(lfd);
+		return -1;
+	}
+
+	*wfd = socket(AF_INET, SOCK_STREAM, 0);
+	if (-1 == *wfd || 0 != connect(*wfd, (struct sockaddr *)&addr, sizeof(addr))) {
+		close(lfd);
+		return -1;
+	}
+	*rfd = accept(lfd, NULL, NULL);
+	close(lfd);
+
+	if (-1 == *rfd) return -1;
+
+	fcntl(*wfd, F_SETFL, fcntl(*wfd, F_GETFL) | O_NONBLOCK);
+
+	return 0;
+}
+
+static int run(bench_mode mode, char *data) {
+	network_tcp_pacing pacing;
+	struct pollfd pfd;
+	pthread_t tid;
+	unsigned long sent = 0, polls = 0, writes = 0, samples = 0, eagain = 0;
+	uint64_t start, ns;
+	size_t len;
+	ssize_t n;
+	void *ok;
+	int wfd, rfd;
+
+	if (0 != bench_connect(&wfd, &rfd)) {
+		perror("connect");
+		return -1;
+	}
+
+	network_tcp_pacing_init(&pacing);
+	if (mode != MODE_FIXED && lowat) network_set_notsent_lowat(wfd, &pacing, lowat);
+	pthread_create(&tid, NULL, receiver, (void *)(size_t)rfd);
+
+	start = bench_now_ns();
+
+	while (sent < total) {
+		pfd.fd = wfd;
+		pfd.events = POLLOUT;
+		if (poll(&pfd, 1, -1) <= 0) break;
+		polls++;
+
+		while (sent < total) {
+			if (mode == MODE_FIXED) {
+				len = limit;
+			} else {
+				if (mode == MODE_PER_WRITE) network_write_pass_end(&pacing);
+				if (!pacing.sampled) samples++;
+				len = network_write_budget(wfd, &pacing, limit);
+				if (len == 0) break;
+			}
+			if (len > total - sent) len = total - sent;
+
+			n = write(wfd, data, len);
+			writes++;
+			if (n == -1) {
+				if (errno == EAGAIN) eagain++;
+				break;
+			}
+
+			sent += n;
+			if (mode != MODE_FIXED) network_write_charge(&pacing, n);
+			if ((size_t)n < len) break;
+		}
+
+		network_write_pass_end(&pacing);
+	}
+
+	close(wfd);
+	pthread_join(tid, &ok);
+	ns = bench_now_ns() - start;
+	close(rfd);
+
+	printf("%-9s %8.1f MB/s  polls=%-7lu writes=%-7lu samples=%-7lu eagain=%-7lu syscalls=%lu\n",
+		mode_names[mode],
+		(double)total / ns * 1000,
+		polls, writes, samples, eagain,
+		polls + writes + samples * 2);
+
+	return ok ? 0 : -1;
+}
+
+int main(int argc, char **argv) {
+	network_tcp_feedback fb;
+	char *data;
+	int wfd, rfd, ret = 0;
+	bench_mode mode;
+
+	total = bench_arg(argc, argv, 1, 256) * 1024 * 1024;
+	rdsize = bench_arg(argc, argv, 2, 64 * 1024);
+	limit = bench_arg(argc, argv, 3, MAX_WRITE_LIMIT);
+	lowat = bench_arg(argc, argv, 4, 128 * 1024);
+
+	if (rdsize == 0 || limit == 0) {
+		fprintf(stderr, "read size and write limit must not be 0\n");
+		return 2;
+	}
+
+	/* 取不到状态时per_write和per_pass都退化成fixed，结果没有意义 */
+	if (0 != bench_connect(&wfd, &rfd)) {
+		perror("connect");
+		return 2;
+	}
+	if (0 != network_tcp_get_feedback(wfd, &fb)) {
+		fprintf(stderr, "no TCP feedback on this system\n");
+		return 2;
+	}
+	close(wfd);
+	close(rfd);
+
+	data = calloc(1, limit);
+
+	printf("total=%luMB read=%lu limit=%lu lowat=%lu\n", total / 1024 / 1024, rdsize, limit, lowat);
+
+	for (mode = MODE_FIXED; mode <= MODE_PER_PASS; mode++) {
+		if (0 != run(mode, data)) ret = 1;
+	}
+
+	free(data);
+
+	return ret;
+}
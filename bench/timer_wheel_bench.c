@@ -0,0 +1,262 @@
+
+/**
+ * 时间轮的随机测试和性能测试
+ *
+ * 随机测试:对一组定时器随机地加入、取消和推进，同时维护一个
+ * 简单的模型(每个定时器是否加入、何时到期)，检查
+ *
+ *  - 回调只对加入了的定时器调用，且正好在到期的tick调用
+ *  - 推进之后没有到期而未调用的定时器
+ *  - used和模型中加入的个数相同
+ *  - timer_wheel_next_timeout不晚于最早的到期时间
+ *
+ * 回调中还会随机地重新加入自己(返回HANDLER_COMEBACK)、取消或
+ * 加入别的定时器，包括同一个tick中还没有处理的定时器
+ *
+ * 性能测试:加入一百万个定时器，全部重新加入一次(连接有活动)，
+ * 取消一半，再推进到剩下的全部到期
+ *
+ *	timer_wheel_bench [随机测试的定时器个数 [操作次数 [性能测试的定时器个数 [种子]]]]
+ */
+
+#include "buffer.h"
+#include "timer_wheel.h"
+#include "bench.h"
+
+#include <stdio.h>
+#include <string.h>
+
+typedef struct {
+	timer_node node;
+	size_t id;
+	int armed;           /* 模型:是否加入 */
+	uint64_t expires;    /* 模型:到期的tick */
+	uint64_t timeout;
+} bench_timer;
+
+static bench_timer *timers;
+static size_t ntimers;
+static uint64_t rng;
+static unsigned long errors;
+static size_t model_used;
+
+static uint64_t bench_timeout(void) {
+	uint64_t r = bench_rand(&rng) % 100;
+
+	if (r < 5) return 0;
+	if (r < 50) return bench_rand(&rng) % TIMER_WHEEL_SLOTS;
+	if (r < 80) return bench_rand(&rng) % (TIMER_WHEEL_SLOTS * TIMER_WHEEL_SLOTS);
+	if (r < 97) return bench_rand(&rng) % ((uint64_t)1 << (TIMER_WHEEL_BITS * 3));
+	return bench_rand(&rng) % (TIMER_WHEEL_MAX_TIMEOUT * 2);
+}
+
+/**
+ * 加入定时器，并同样地更新模型
+ */
+static void model_arm(timer_wheel *w, bench_timer *t, uint64_t timeout) {
+	timer_wheel_arm(w, &t->node, timeout);
+
+	if (timeout == 0) timeout = 1;
+	if (timeout > TIMER_WHEEL_MAX_TIMEOUT) timeout = TIMER_WHEEL_MAX_TIMEOUT;
+
+	if (!t->armed) model_used++;
+	t->armed = 1;
+	t->timeout = timeout;
+	t->expires = w->now + timeout;
+}
+
+static void model_cancel(timer_wheel *w, bench_timer *t) {
+	timer_wheel_cancel(w, &t->node);
+
+	if (t->armed) model_used--;
+	t->armed = 0;
+}
+
+static handler_t fuzz_cb(timer_wheel *w, timer_node *node, void *ctx) {
+	bench_timer *t = ctx, *other;
+	uint64_t r;
+
+	if (!t->armed || t->expires != w->now) {
+		printf("timer %zu fired at %llu, model armed=%d expires=%llu\n",
+			t->id, (unsigned long long)w->now, t->armed, (unsigned long long)t->expires);
+		errors++;
+	}
+	if (node->armed) {
+		printf("timer %zu still armed in its callback\n", t->id);
+		errors++;
+	}
+	if (t->armed) model_used--;
+	t->armed = 0;
+
+	r = bench_rand(&rng) % 16;
+	other = timers + bench_rand(&rng) % ntimers;
+
+	switch (r) {
+	case 0:
+		if (other != t) model_cancel(w, other);
+		break;
+	case 1:
+		model_arm(w, other, bench_timeout());
+		break;
+	case 2:
+	case 3:
+		/* 以原来的超时重新加入 */
+		model_used++;
+		t->armed = 1;
+		t->expires = w->now + t->timeout;
+		return HANDLER_COMEBACK;
+	}
+
+	return HANDLER_GO_ON;
+}
+
+/**
+ * 推进之后检查模型
+ */
+static void model_check(timer_wheel *w) {
+	uint64_t next, min = TIMER_WHEEL_MAX_TIMEOUT;
+	size_t i;
+
+	for (i = 0; i < ntimers; i++) {
+		bench_timer *t = timers + i;
+
+		if (!t->armed) continue;
+		if (t->expires <= w->now) {
+			printf("timer %zu missed, expires=%llu now=%llu\n",
+				t->id, (unsigned long long)t->expires, (unsigned long long)w->now);
+			errors++;
+			continue;
+		}
+		if (t->expires - w->now < min) min = t->expires - w->now;
+	}
+
+	if (w->used != model_used) {
+		printf("used=%zu, model has %zu\n", w->used, model_used);
+		errors++;
+	}
+
+	next = timer_wheel_next_timeout(w);
+	if (next > min || next == 0) {
+		printf("next_timeout=%llu, earliest is %llu\n", (unsigned long long)next, (unsigned long long)min);
+		errors++;
+	}
+}
+
+static void fuzz(unsigned long ops) {
+	timer_wheel w;
+	uint64_t r, step, start = bench_rand(&rng) % 1000000;
+	unsigned long i;
+	size_t fired = 0;
+
+	timers = calloc(ntimers, sizeof(*timers));
+	for (i = 0; i < ntimers; i++) {
+		timer_node_init(&timers[i].node, fuzz_cb, timers + i);
+		timers[i].id = i;
+	}
+
+	timer_wheel_init(&w, start);
+	model_used = 0;
+
+	for (i = 0; i < ops && errors < 10; i++) {
+		bench_timer *t = timers + bench_rand(&rng) % ntimers;
+
+		r = bench_rand(&rng) % 100;
+		if (r < 50) {
+			model_arm(&w, t, bench_timeout());
+		} else if (r < 65) {
+			model_cancel(&w, t);
+		} else {
+			r = bench_rand(&rng) % 1000;
+			if (r < 900) {
+				step = bench_rand(&rng) % 8;
+			} else if (r < 998) {
+				step = bench_rand(&rng) % (TIMER_WHEEL_SLOTS * TIMER_WHEEL_SLOTS);
+			} else {
+				step = bench_rand(&rng) % ((uint64_t)1 << 20);
+			}
+
+			fired += timer_wheel_advance(&w, w.now + step);
+			model_check(&w);
+		}
+	}
+
+	/* 最后推进到全部到期 */
+	fired += timer_wheel_advance(&w, w.now + TIMER_WHEEL_MAX_TIMEOUT + 1);
+	for (i = 0; i < ntimers; i++) model_cancel(&w, timers + i);
+	model_check(&w);
+
+	printf("fuzz: timers=%zu ops=%lu fired=%zu ticks=%llu errors=%lu\n",
+		ntimers, ops, fired, (unsigned long long)(w.now - start), errors);
+
+	free(timers);
+}
+
+static handler_t bench_cb(timer_wheel *w, timer_node *node, void *ctx) {
+	UNUSED(w);
+	UNUSED(node);
+	UNUSED(ctx);
+	return HANDLER_GO_ON;
+}
+
+static void bench(size_t n) {
+	timer_wheel w;
+	timer_node *nodes;
+	uint64_t start, ns, max = 0;
+	size_t i, fired;
+
+	nodes = malloc(n * sizeof(*nodes));
+	for (i = 0; i < n; i++) timer_node_init(nodes + i, bench_cb, NULL);
+
+	timer_wheel_init(&w, 0);
+
+	/* 超时取1到3600秒，和空闲连接的超时相当 */
+	start = bench_now_ns();
+	for (i = 0; i < n; i++) timer_wheel_arm(&w, nodes + i, 1 + bench_rand(&rng) % 3600);
+	ns = bench_now_ns() - start;
+	printf("arm     %8.1f ns/op\n", (double)ns / n);
+
+	start = bench_now_ns();
+	for (i = 0; i < n; i++) timer_wheel_arm(&w, nodes + i, 1 + bench_rand(&rng) % 3600);
+	ns = bench_now_ns() - start;
+	printf("rearm   %8.1f ns/op\n", (double)ns / n);
+
+	start = bench_now_ns();
+	for (i = 0; i < n; i += 2) timer_wheel_cancel(&w, nodes + i);
+	ns = bench_now_ns() - start;
+	printf("cancel  %8.1f ns/op\n", (double)ns / ((n + 1) / 2));
+
+	start = bench_now_ns();
+	fired = 0;
+	while (w.used) {
+		uint64_t t = bench_now_ns();
+
+		fired += timer_wheel_advance(&w, w.now + 1);
+		t = bench_now_ns() - t;
+		if (t > max) max = t;
+	}
+	ns = bench_now_ns() - start;
+	printf("advance %8.1f ns/fired  ticks=%llu  slowest tick=%.1f us  fired=%zu\n",
+		fired ? (double)ns / fired : 0.0, (unsigned long long)w.now, (double)max / 1000, fired);
+
+	free(nodes);
+}
+
+int main(int argc, char **argv) {
+	unsigned long ops;
+	size_t nbench;
+
+	ntimers = bench_arg(argc, argv, 1, 512);
+	ops = bench_arg(argc, argv, 2, 200000);
+	nbench = bench_arg(argc, argv, 3, 1000000);
+	rng = bench_arg(argc, argv, 4, 88172645463325252ULL);
+
+	if (ntimers == 0 || rng == 0) {
+		fprintf(stderr, "need at least one timer and a non-zero seed\n");
+		return 2;
+	}
+
+	fuzz(ops);
+	if (nbench) bench(nbench);
+
+	return errors ? 1 : 0;
+}
@@ -8,31 +8,90 @@
 #include <assert.h>
 
 /**
- *用于得到size_t位的大小 n_Bytes * Byte.size CAHR_BIT在limits.h中
- * 定义，其表示一个字符所占多少位，一般为8
+ * 计算size_t中最低的置位是第几位，w不能为0
  */
-#define BITSET_BITS \
-	( CHAR_BIT * sizeof(size_t) )
+static inline size_t bitset_ctz(size_t w) {
+#if defined(__GNUC__)
+	return __builtin_ctzll((unsigned long long)w);
+#else
+	size_t n = 0;
+
+	while (!(w & 1)) {
+		w >>= 1;
+		n++;
+	}
+	return n;
+#endif
+}
 
 /**
- * 将一个size_t类型的第pos位置位
+ * 计算size_t中置位的位数
  */
-#define BITSET_MASK(pos) \
-	( ((size_t)1) << ((pos) % BITSET_BITS) )
+static inline size_t bitset_popcount_word(size_t w) {
+#if defined(__GNUC__)
+	return __builtin_popcountll((unsigned long long)w);
+#else
+	size_t n = 0;
+
+	for (; w; w &= w - 1) n++;
+	return n;
+#endif
+}
+
 /**
- * 取bitset类型set的pos所在size_t单位
+ * 根据bits中[from, to)这些字是否为0，更新summary中对应的位
  */
-#define BITSET_WORD(set, pos) \
-	( (set)->bits[(pos) / BITSET_BITS] )
+static void bitset_summary_update(bitset *set, size_t from, size_t to) {
+	size_t w;
+
+	for (w = from; w < to; w++) {
+		if (set->bits[w]) {
+			set->summary[w / BITSET_BITS] |= BITSET_MASK(w);
+		} else {
+			set->summary[w / BITSET_BITS] &= ~BITSET_MASK(w);
+		}
+	}
+}
+
 /**
- * 得到应该分配几个BITSET_BITS块
+ * 计算nbits个位的bitset一共需要分配多少字节
+ *
+ * 结构之后依次是bits和summary两个数组
  */
-#define BITSET_USED(nbits) \
-	( ((nbits) + (BITSET_BITS - 1)) / BITSET_BITS )
+static size_t bitset_alloc_size(size_t nbits) {
+	return sizeof(bitset) +
+		(BITSET_USED(nbits) + BITSET_USED(BITSET_USED(nbits))) * sizeof(size_t);
+}
+
+/**
+ * 分配一块按BITSET_ALIGN对齐的内存，并设置好nbits和summary
+ *
+ * @param nbits 位的个数
+ *
+ * @return 分配好的bitset对象，位数组的内容未初始化
+ */
+static bitset *bitset_alloc(size_t nbits) {
+	void *p = NULL;
+	bitset *set;
+
+	if (0 != posix_memalign(&p, BITSET_ALIGN, bitset_alloc_size(nbits))) {
+		p = NULL;
+	}
+	assert(p);
+
+	set = p;
+	set->nbits = nbits;
+	/* summary紧跟在bits之后 */
+	set->summary = set->bits + BITSET_USED(nbits);
+
+	return set;
+}
 
 /**
  * 这个不仅初始话，同时也是声明或创造一个含有nbits个位的
  * bitset 的数据结构的set变量
+ *
+ * 只做一次分配，结构、bits和summary都在其中
  * 
  * @param nbits 初始话bit的位数
  * 
@@ -41,13 +100,8 @@
 bitset *bitset_init(size_t nbits) {
 	bitset *set;
 
-	set = malloc(sizeof(*set));
-	assert(set);
-/* -> 的优先级高于*,所以*set->bits表示set的bits成员所指的对象  */
-	set->bits = calloc(BITSET_USED(nbits), sizeof(*set->bits));
-	set->nbits = nbits;
-
-	assert(set->bits);
+	set = bitset_alloc(nbits);
+	bitset_reset(set);
 
 	return set;
 }
@@ -59,7 +113,8 @@ bitset *bitset_init(size_t nbits) {
  * @param set 要清零的对象
  */
 void bitset_reset(bitset *set) {
-	memset(set->bits, 0, BITSET_USED(set->nbits) * sizeof(*set->bits));
+	/* summary紧跟在bits之后，一起清零 */
+	memset(set->bits, 0, bitset_alloc_size(set->nbits) - sizeof(bitset));
 }
 
 /** 
@@ -68,51 +123,237 @@ void bitset_reset(bitset *set) {
  * @param 要释放内存的对象
  */
 void bitset_free(bitset *set) {
-	free(set->bits);
 	free(set);
 }
 
 /**
- * 将bitset类型的set变量中的bits的第pos位清零
- * 
- * @param set 要操作的对象
- * @param pos 第pos位
+ * 从第pos位开始查找第一个置位的位
+ *
+ * 先看pos所在的字，如果剩下的位都为0，再通过summary
+ * 一次跳过BITSET_BITS个全0的字，因此稀疏的集合只需
+ * 检查很少的几个字，而不用对每一位调用bitset_test_bit
+ *
+ * @param set 要查找的对象
+ * @param pos 开始查找的位置
+ *
+ * @return 找到返回该位的位置，否则返回set->nbits
  */
-void bitset_clear_bit(bitset *set, size_t pos) {
-	if (pos >= set->nbits) {
-	    SEGFAULT();
+size_t bitset_find_next_set(bitset *set, size_t pos) {
+	size_t w, s, word, nwords;
+
+	if (pos >= set->nbits) return set->nbits;
+
+	/* pos所在的字中，pos及之后的位 */
+	w = pos / BITSET_BITS;
+	word = set->bits[w] & (~(size_t)0 << (pos % BITSET_BITS));
+	if (word) return w * BITSET_BITS + bitset_ctz(word);
+
+	/* 通过summary找下一个不为0的字 */
+	nwords = BITSET_USED(set->nbits);
+	if (++w >= nwords) return set->nbits;
+
+	s = w / BITSET_BITS;
+	word = set->summary[s] & (~(size_t)0 << (w % BITSET_BITS));
+	while (0 == word) {
+		if (++s >= BITSET_USED(nwords)) return set->nbits;
+		word = set->summary[s];
 	}
 
-	/* 先取出pos所在的size_t单位，然后将其与一个size_t进行与，可修改该位 */
-	BITSET_WORD(set, pos) &= ~BITSET_MASK(pos);
+	w = s * BITSET_BITS + bitset_ctz(word);
+
+	return w * BITSET_BITS + bitset_ctz(set->bits[w]);
 }
 
 /**
- * 将bitset类型的set变量中的bits的第pos位置位
- * 
- * @param set 要操作的对象
- * @param pos 要操作的第pos位
+ * 查找第一个置位的位
+ *
+ * @return 找到返回该位的位置，否则返回set->nbits
+ */
+size_t bitset_find_first_set(bitset *set) {
+	return bitset_find_next_set(set, 0);
+}
+
+/**
+ * 查找第一个为0的位
+ *
+ * summary只记录了字是否为0，帮不上忙，这里逐个字取反后查找
+ *
+ * @return 找到返回该位的位置，否则返回set->nbits
  */
-void bitset_set_bit(bitset *set, size_t pos) {
-	if (pos >= set->nbits) {
-	    SEGFAULT();
+size_t bitset_find_first_clear(bitset *set) {
+	size_t w, pos, nwords = BITSET_USED(set->nbits);
+
+	for (w = 0; w < nwords; w++) {
+		if (~set->bits[w]) {
+			pos = w * BITSET_BITS + bitset_ctz(~set->bits[w]);
+			/* 最后一个字中超出nbits的位总是0，不能算 */
+			return pos < set->nbits ? pos : set->nbits;
+		}
 	}
 
-	BITSET_WORD(set, pos) |= BITSET_MASK(pos);
+	return set->nbits;
 }
 
-/** 
- * 判断bitset类型变量set中bits的第pos位是否为1
+/**
+ * 两个位集合的整体运算
+ *
+ * 按字进行运算，循环很简单，编译器可以自动展开成SIMD指令。
+ * 运算之后根据结果重新生成dst的summary
+ *
+ * 两个对象的nbits不同时报段错误
+ */
+#define BITSET_COMBINE(dst, src, op) do { \
+	size_t w_, n_; \
+	if ((dst)->nbits != (src)->nbits) { \
+		SEGFAULT(); \
+	} \
+	n_ = BITSET_USED((dst)->nbits); \
+	for (w_ = 0; w_ < n_; w_++) { \
+		(dst)->bits[w_] op; \
+	} \
+	bitset_summary_update((dst), 0, n_); \
+} while (0)
+
+/**
+ * dst &= src
+ */
+void bitset_and(bitset *dst, bitset *src) {
+	BITSET_COMBINE(dst, src, &= src->bits[w_]);
+}
+
+/**
+ * dst |= src
+ */
+void bitset_or(bitset *dst, bitset *src) {
+	BITSET_COMBINE(dst, src, |= src->bits[w_]);
+}
+
+/**
+ * dst ^= src
+ */
+void bitset_xor(bitset *dst, bitset *src) {
+	BITSET_COMBINE(dst, src, ^= src->bits[w_]);
+}
+
+/**
+ * dst &= ~src，即从dst中去掉src中置位的位
+ */
+void bitset_andnot(bitset *dst, bitset *src) {
+	BITSET_COMBINE(dst, src, &= ~src->bits[w_]);
+}
+
+/**
+ * 判断两个位集合是否相等
+ *
+ * 超出nbits的位总是0，因此可以直接比较整个字
+ *
+ * @return 相等返回1，否则返回0
+ */
+int bitset_is_equal(bitset *a, bitset *b) {
+	if (a->nbits != b->nbits) return 0;
+
+	return 0 == memcmp(a->bits, b->bits, BITSET_USED(a->nbits) * sizeof(*a->bits));
+}
+
+/**
+ * 统计置位的位数
+ *
+ * @return 置位的位数
+ */
+size_t bitset_popcount(bitset *set) {
+	size_t w, n = 0, nwords = BITSET_USED(set->nbits);
+
+	for (w = 0; w < nwords; w++) {
+		n += bitset_popcount_word(set->bits[w]);
+	}
+
+	return n;
+}
+
+/**
+ * 对[from, to)范围内的位置位或清零
+ *
+ * 两端的字用掩码处理，中间的字整个赋值
  *
  * @param set 要操作的对象
- * @param pos 要检测的第pos位
+ * @param from 开始的位置
+ * @param to 结束的位置，不包括该位
+ * @param on 1为置位，0为清零
+ */
+static void bitset_fill_range(bitset *set, size_t from, size_t to, int on) {
+	size_t fw, lw, w, lo, hi;
+
+	if (from > to || to > set->nbits) {
+		SEGFAULT();
+	}
+	if (from == to) return;
+
+	fw = from / BITSET_BITS;
+	lw = (to - 1) / BITSET_BITS;
+	lo = ~(size_t)0 << (from % BITSET_BITS);
+	hi = ~(size_t)0 >> (BITSET_BITS - 1 - (to - 1) % BITSET_BITS);
+
+	for (w = fw; w <= lw; w++) {
+		size_t mask = ~(size_t)0;
+
+		if (w == fw) mask &= lo;
+		if (w == lw) mask &= hi;
+
+		if (on) {
+			set->bits[w] |= mask;
+		} else {
+			set->bits[w] &= ~mask;
+		}
+	}
+
+	bitset_summary_update(set, fw, lw + 1);
+}
+
+/**
+ * 将[from, to)范围内的位全部置位
+ */
+void bitset_set_range(bitset *set, size_t from, size_t to) {
+	bitset_fill_range(set, from, to, 1);
+}
+
+/**
+ * 将[from, to)范围内的位全部清零
+ */
+void bitset_clear_range(bitset *set, size_t from, size_t to) {
+	bitset_fill_range(set, from, to, 0);
+}
+
+/**
+ * 改变位集合的大小
  *
- * @return  为1时返回1，否则返回0
+ * bitset_init时的nbits不再是固定的，id空间增长时可以随之扩大。
+ * 扩大时新增的位都为0，缩小时被截掉的位直接丢弃。
+ * 为了保持对齐，总是分配一块新的内存再把内容复制过去，
+ * 调用者必须使用返回的指针，原来的指针已经被释放
+ *
+ * @param set 要改变大小的对象
+ * @param nbits 新的位数
+ *
+ * @return 改变大小后的bitset对象
  */
-int bitset_test_bit(bitset *set, size_t pos) {
-	if (pos >= set->nbits) {
-	    SEGFAULT();
+bitset *bitset_resize(bitset *set, size_t nbits) {
+	bitset *n;
+	size_t words, swords;
+
+	if (nbits < set->nbits) {
+		/* 先清掉被截掉的位，保证超出nbits的位总是0 */
+		bitset_fill_range(set, nbits, set->nbits, 0);
 	}
 
-	return (BITSET_WORD(set, pos) & BITSET_MASK(pos)) != 0;
+	n = bitset_init(nbits);
+
+	words = BITSET_USED(nbits < set->nbits ? nbits : set->nbits);
+	swords = BITSET_USED(words);
+
+	memcpy(n->bits, set->bits, words * sizeof(*set->bits));
+	memcpy(n->summary, set->summary, swords * sizeof(*set->summary));
+
+	bitset_free(set);
+
+	return n;
 }
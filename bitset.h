@@ -3,18 +3,133 @@
 
 #include <stddef.h>
 /* setdef.h 里面定义了size_t */
+#include <limits.h>
+#include <assert.h>
 
+/**
+ * 结构和位数组在同一块按缓存行对齐的内存中，只需一次分配，
+ * nbits和开头的几个字也落在同一个缓存行里
+ *
+ * 很大而稀疏的id空间用bitset_sparse.h中的压缩表示
+ */
 typedef struct {
-	size_t *bits;
 	size_t nbits;
+	size_t *summary; /* 第i位为1表示bits[i]不为0，用于快速跳过全0的字，指向bits之后 */
+	size_t bits[];
 } bitset;
 
+/**
+ * 分配bitset时的对齐大小，即一个缓存行
+ */
+#define BITSET_ALIGN 64
+
+/**
+ *用于得到size_t位的大小 n_Bytes * Byte.size CAHR_BIT在limits.h中
+ * 定义，其表示一个字符所占多少位，一般为8
+ */
+#define BITSET_BITS \
+	( CHAR_BIT * sizeof(size_t) )
+
+/**
+ * 将一个size_t类型的第pos位置位
+ */
+#define BITSET_MASK(pos) \
+	( ((size_t)1) << ((pos) % BITSET_BITS) )
+/**
+ * 取bitset类型set的pos所在size_t单位
+ */
+#define BITSET_WORD(set, pos) \
+	( (set)->bits[(pos) / BITSET_BITS] )
+/**
+ * 得到应该分配几个BITSET_BITS块
+ */
+#define BITSET_USED(nbits) \
+	( ((nbits) + (BITSET_BITS - 1)) / BITSET_BITS )
+
+/**
+ * 取pos所在的字在summary中对应的size_t单位和掩码
+ */
+#define BITSET_SUMMARY_WORD(set, pos) \
+	( (set)->summary[(pos) / BITSET_BITS / BITSET_BITS] )
+#define BITSET_SUMMARY_MASK(pos) \
+	BITSET_MASK((pos) / BITSET_BITS)
+
 bitset *bitset_init(size_t nbits); /* 定义一个nbits大小的位集合对象 */
 void bitset_reset(bitset *set);    /* 将一个位集合对像清零 */
 void bitset_free(bitset *set);	   /* 释放一个位集合对象所占内存 */
+bitset *bitset_resize(bitset *set, size_t nbits); /* 改变位集合对象的大小，用法同realloc */
+
+/**
+ * 单个位的操作定义成static inline，编译器可以把它们直接
+ * 合并到调用者的循环中。越界检查用assert完成，调试版本中
+ * 越界会中止程序，定义了NDEBUG的发布版本中不做检查
+ */
+
+/**
+ * 将bitset类型的set变量中的bits的第pos位清零
+ *
+ * @param set 要操作的对象
+ * @param pos 第pos位
+ */
+static inline void bitset_clear_bit(bitset *set, size_t pos) {
+	assert(pos < set->nbits);
+
+	/* 先取出pos所在的size_t单位，然后将其与一个size_t进行与，可修改该位 */
+	BITSET_WORD(set, pos) &= ~BITSET_MASK(pos);
+
+	/* 整个字变为0时，同步清除summary中对应的位 */
+	if (0 == BITSET_WORD(set, pos)) {
+		BITSET_SUMMARY_WORD(set, pos) &= ~BITSET_SUMMARY_MASK(pos);
+	}
+}
+
+/**
+ * 将bitset类型的set变量中的bits的第pos位置位
+ *
+ * @param set 要操作的对象
+ * @param pos 要操作的第pos位
+ */
+static inline void bitset_set_bit(bitset *set, size_t pos) {
+	assert(pos < set->nbits);
+
+	BITSET_WORD(set, pos) |= BITSET_MASK(pos);
+	BITSET_SUMMARY_WORD(set, pos) |= BITSET_SUMMARY_MASK(pos);
+}
+
+/**
+ * 判断bitset类型变量set中bits的第pos位是否为1
+ *
+ * @param set 要操作的对象
+ * @param pos 要检测的第pos位
+ *
+ * @return  为1时返回1，否则返回0
+ */
+static inline int bitset_test_bit(bitset *set, size_t pos) {
+	assert(pos < set->nbits);
+
+	return (BITSET_WORD(set, pos) & BITSET_MASK(pos)) != 0;
+}
+
+/**
+ * 查找函数，没有找到时返回set->nbits，遍历所有置位的位:
+ *
+ *	for (i = bitset_find_first_set(set); i < set->nbits; i = bitset_find_next_set(set, i + 1))
+ */
+size_t bitset_find_first_set(bitset *set);            /* 第一个置位的位 */
+size_t bitset_find_next_set(bitset *set, size_t pos); /* 从pos开始第一个置位的位 */
+size_t bitset_find_first_clear(bitset *set);          /* 第一个为0的位 */
+
+/**
+ * 整体操作，按字进行，dst和src的nbits必须相同
+ */
+void bitset_and(bitset *dst, bitset *src);    /* dst &= src */
+void bitset_or(bitset *dst, bitset *src);     /* dst |= src */
+void bitset_xor(bitset *dst, bitset *src);    /* dst ^= src */
+void bitset_andnot(bitset *dst, bitset *src); /* dst &= ~src */
+int bitset_is_equal(bitset *a, bitset *b);    /* 两个位集合是否相等 */
+size_t bitset_popcount(bitset *set);          /* 置位的位数 */
 
-void bitset_clear_bit(bitset *set, size_t pos);  /* 将一个位集合对象的某位清零 */
-void bitset_set_bit(bitset *set, size_t pos); 	 /* 将一个位集合对象的某位置位 */
-int bitset_test_bit(bitset *set, size_t pos);	 /* 测试一个位集合对象某位是否置位 */
+void bitset_set_range(bitset *set, size_t from, size_t to);   /* 将[from, to)置位 */
+void bitset_clear_range(bitset *set, size_t from, size_t to); /* 将[from, to)清零 */
 
 #endif
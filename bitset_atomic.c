@@ -0,0 +1,188 @@
+#include "bitset_atomic.h"
+#include "bitset.h"
+#include "buffer.h"
+
+#ifdef HAVE_BITSET_ATOMIC
+
+#include <stdlib.h>
+#include <assert.h>
+
+/**
+ * 计算size_t中最低的置位是第几位，w不能为0
+ */
+static inline size_t bitset_atomic_ctz(size_t w) {
+#if defined(__GNUC__)
+	return __builtin_ctzll((unsigned long long)w);
+#else
+	size_t n = 0;
+
+	while (!(w & 1)) {
+		w >>= 1;
+		n++;
+	}
+	return n;
+#endif
+}
+
+/**
+ * 初始化一个含有nbits个位的原子位集合，全部为0
+ *
+ * @param nbits 位的个数
+ *
+ * @return 成功时返回bitset_atomic对象
+ */
+bitset_atomic *bitset_atomic_init(size_t nbits) {
+	bitset_atomic *set;
+	size_t i, n = BITSET_USED(nbits);
+
+	set = malloc(sizeof(*set));
+	assert(set);
+
+	set->bits = malloc(n * sizeof(*set->bits));
+	assert(set->bits);
+
+	for (i = 0; i < n; i++) {
+		atomic_init(&set->bits[i], 0);
+	}
+	atomic_init(&set->hint, 0);
+	set->nbits = nbits;
+
+	return set;
+}
+
+/**
+ * 释放原子位集合所用的内存
+ *
+ * 调用者要保证此时已经没有其它线程在使用set
+ */
+void bitset_atomic_free(bitset_atomic *set) {
+	free(set->bits);
+	free(set);
+}
+
+/**
+ * 判断第pos位是否为1
+ *
+ * @return 为1时返回1，否则返回0
+ */
+int bitset_atomic_test_bit(bitset_atomic *set, size_t pos) {
+	if (pos >= set->nbits) {
+		SEGFAULT();
+	}
+
+	return (atomic_load_explicit(&BITSET_WORD(set, pos), memory_order_acquire) & BITSET_MASK(pos)) != 0;
+}
+
+/**
+ * 将第pos位置位，并返回原来的值
+ *
+ * 用一条fetch_or完成，多个线程同时对同一位置位时
+ * 只有一个会得到0，即只有一个线程拿到这个槽位
+ *
+ * @return 原来为1时返回1，否则返回0
+ */
+int bitset_atomic_test_and_set(bitset_atomic *set, size_t pos) {
+	if (pos >= set->nbits) {
+		SEGFAULT();
+	}
+
+	return (atomic_fetch_or_explicit(&BITSET_WORD(set, pos), BITSET_MASK(pos), memory_order_acq_rel) & BITSET_MASK(pos)) != 0;
+}
+
+/**
+ * 将第pos位清零，并返回原来的值，用于释放槽位
+ *
+ * @return 原来为1时返回1，否则返回0
+ */
+int bitset_atomic_test_and_clear(bitset_atomic *set, size_t pos) {
+	if (pos >= set->nbits) {
+		SEGFAULT();
+	}
+
+	return (atomic_fetch_and_explicit(&BITSET_WORD(set, pos), ~BITSET_MASK(pos), memory_order_acq_rel) & BITSET_MASK(pos)) != 0;
+}
+
+/**
+ * 从start所指的字开始，绕一圈查找含有0的字，取其中最低的0位，
+ * 用CAS把整个字换成置位后的值。CAS失败说明别的线程修改了
+ * 这个字，用新读到的值重试即可，不需要加锁
+ *
+ * @param word 返回分配到的位所在的字
+ *
+ * @return 成功返回分配到的位，已经全满时返回set->nbits
+ */
+static size_t bitset_atomic_claim_from(bitset_atomic *set, size_t start, size_t *word) {
+	size_t nwords = BITSET_USED(set->nbits);
+	size_t i, w, v, pos;
+
+	for (i = 0; i < nwords; i++) {
+		w = (start + i) % nwords;
+		v = atomic_load_explicit(&set->bits[w], memory_order_relaxed);
+
+		while (~v) {
+			pos = w * BITSET_BITS + bitset_atomic_ctz(~v);
+
+			/* 最后一个字中超出nbits的位不能分配 */
+			if (pos >= set->nbits) break;
+
+			if (atomic_compare_exchange_weak_explicit(&set->bits[w], &v, v | BITSET_MASK(pos),
+					memory_order_acq_rel, memory_order_relaxed)) {
+				*word = w;
+				return pos;
+			}
+		}
+	}
+
+	return set->nbits;
+}
+
+/**
+ * 分配一个空闲的槽位，从共享的hint开始查找
+ *
+ * 只有在hint所指的字已经满了、分配落到别的字上时才更新hint，
+ * 平常的分配只读hint，不会让所有线程反复写同一个cache line
+ *
+ * @param set 要分配的对象
+ *
+ * @return 成功返回分配到的位，已经全满时返回set->nbits
+ */
+size_t bitset_atomic_claim_first_clear(bitset_atomic *set) {
+	size_t nwords = BITSET_USED(set->nbits);
+	size_t start, w, pos;
+
+	if (nwords == 0) return set->nbits;
+
+	start = atomic_load_explicit(&set->hint, memory_order_relaxed) % nwords;
+
+	pos = bitset_atomic_claim_from(set, start, &w);
+	if (pos != set->nbits && w != start) {
+		atomic_store_explicit(&set->hint, w, memory_order_relaxed);
+	}
+
+	return pos;
+}
+
+/**
+ * 分配一个空闲的槽位，从调用者自己的hint开始查找
+ *
+ * 每个线程用自己的hint(例如初始化为线程编号乘以字数再除以线程数)，
+ * 各线程从不同的字开始分配，不争用同一个字，也不写共享的hint
+ *
+ * @param set 要分配的对象
+ * @param hint 调用者保存的hint，分配成功后指向这次用到的字
+ *
+ * @return 成功返回分配到的位，已经全满时返回set->nbits
+ */
+size_t bitset_atomic_claim_first_clear_hint(bitset_atomic *set, size_t *hint) {
+	size_t nwords = BITSET_USED(set->nbits);
+	size_t w, pos;
+
+	if (nwords == 0) return set->nbits;
+
+	pos = bitset_atomic_claim_from(set, *hint % nwords, &w);
+	if (pos != set->nbits) *hint = w;
+
+	return pos;
+}
+
+#endif
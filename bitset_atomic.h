@@ -0,0 +1,33 @@
+#ifndef _BITSET_ATOMIC_H_
+#define _BITSET_ATOMIC_H_
+
+#include <stddef.h>
+
+/**
+ * 可以被多个线程同时操作的位集合，用于无锁地分配和释放槽位
+ *
+ * 依赖C11的<stdatomic.h>，编译器不支持时整个接口都不存在
+ */
+#if defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L && !defined(__STDC_NO_ATOMICS__)
+#define HAVE_BITSET_ATOMIC 1
+
+#include <stdatomic.h>
+
+typedef struct {
+	_Atomic size_t *bits;
+	size_t nbits;
+	_Atomic size_t hint; /* 下次分配时开始查找的字，只在所指的字满了之后才更新 */
+} bitset_atomic;
+
+bitset_atomic *bitset_atomic_init(size_t nbits);  /* 定义一个nbits大小的原子位集合对象 */
+void bitset_atomic_free(bitset_atomic *set);       /* 释放原子位集合对象，调用时不能有其它线程在使用 */
+
+int bitset_atomic_test_bit(bitset_atomic *set, size_t pos);       /* 测试某位是否置位 */
+int bitset_atomic_test_and_set(bitset_atomic *set, size_t pos);   /* 置位并返回原来的值 */
+int bitset_atomic_test_and_clear(bitset_atomic *set, size_t pos); /* 清零并返回原来的值 */
+size_t bitset_atomic_claim_first_clear(bitset_atomic *set);       /* 找到一个为0的位并置位，满时返回nbits */
+size_t bitset_atomic_claim_first_clear_hint(bitset_atomic *set, size_t *hint); /* 同上，从调用者自己的hint开始查找 */
+
+#endif
+
+#endif
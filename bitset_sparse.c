@@ -0,0 +1,583 @@
+#include "bitset_sparse.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#define BITSET_SPARSE_KEY(pos) ((pos) >> 16)
+#define BITSET_SPARSE_LOW(pos) ((uint32_t)((pos) & 0xffff))
+
+static inline uint32_t bitset_sparse_ctz64(uint64_t w) {
+#if defined(__GNUC__)
+	return __builtin_ctzll(w);
+#else
+	uint32_t n = 0;
+
+	while (!(w & 1)) {
+		w >>= 1;
+		n++;
+	}
+	return n;
+#endif
+}
+
+static inline uint32_t bitset_sparse_popcount64(uint64_t w) {
+#if defined(__GNUC__)
+	return __builtin_popcountll(w);
+#else
+	uint32_t n = 0;
+
+	for (; w; w &= w - 1) n++;
+	return n;
+#endif
+}
+
+bitset_sparse *bitset_sparse_init(void) {
+	bitset_sparse *set;
+
+	set = calloc(1, sizeof(*set));
+	assert(set);
+
+	return set;
+}
+
+static void bitset_sparse_container_free(bitset_sparse_container *c) {
+	if (c->type == BITSET_SPARSE_BITMAP) {
+		free(c->data.bitmap);
+	} else {
+		free(c->data.array);
+	}
+}
+
+void bitset_sparse_reset(bitset_sparse *set) {
+	size_t i;
+
+	for (i = 0; i < set->used; i++) {
+		bitset_sparse_container_free(&set->c[i]);
+	}
+	set->used = 0;
+}
+
+void bitset_sparse_free(bitset_sparse *set) {
+	if (!set) return;
+
+	bitset_sparse_reset(set);
+	free(set->c);
+	free(set);
+}
+
+/**
+ * 二分查找key所在的容器
+ *
+ * @return 第一个key不小于所给key的容器的下标，可能等于set->used
+ */
+static size_t bitset_sparse_lower_bound(bitset_sparse *set, size_t key) {
+	size_t lo = 0, hi = set->used, mid;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (set->c[mid].key < key) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+
+	return lo;
+}
+
+static bitset_sparse_container *bitset_sparse_get_container(bitset_sparse *set, size_t key) {
+	size_t i = bitset_sparse_lower_bound(set, key);
+
+	return (i < set->used && set->c[i].key == key) ? &set->c[i] : NULL;
+}
+
+/**
+ * 取得key对应的容器，不存在时插入一个空的array容器
+ */
+static bitset_sparse_container *bitset_sparse_get_or_create(bitset_sparse *set, size_t key) {
+	bitset_sparse_container *c;
+	size_t i = bitset_sparse_lower_bound(set, key);
+
+	if (i < set->used && set->c[i].key == key) return &set->c[i];
+
+	if (set->used == set->size) {
+		set->size = set->size ? set->size * 2 : 4;
+		set->c = realloc(set->c, set->size * sizeof(*set->c));
+		assert(set->c);
+	}
+
+	memmove(set->c + i + 1, set->c + i, (set->used - i) * sizeof(*set->c));
+	set->used++;
+
+	c = &set->c[i];
+	memset(c, 0, sizeof(*c));
+	c->key = key;
+	c->type = BITSET_SPARSE_ARRAY;
+
+	return c;
+}
+
+static void bitset_sparse_remove_container(bitset_sparse *set, bitset_sparse_container *c) {
+	size_t i = c - set->c;
+
+	bitset_sparse_container_free(c);
+	memmove(set->c + i, set->c + i + 1, (set->used - i - 1) * sizeof(*set->c));
+	set->used--;
+}
+
+/**
+ * 有序数组中第一个不小于v的元素的下标
+ */
+static uint32_t bitset_sparse_array_lower_bound(const uint16_t *a, uint32_t n, uint32_t v) {
+	uint32_t lo = 0, hi = n, mid;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (a[mid] < v) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+
+	return lo;
+}
+
+/**
+ * run容器中最后一个start不大于v的段
+ *
+ * @return 段的下标，没有时返回-1
+ */
+static int32_t bitset_sparse_run_find(bitset_sparse_container *c, uint32_t v) {
+	int32_t lo = 0, hi = (int32_t)c->used - 1, mid, r = -1;
+
+	while (lo <= hi) {
+		mid = lo + (hi - lo) / 2;
+		if (c->data.array[2 * mid] <= v) {
+			r = mid;
+			lo = mid + 1;
+		} else {
+			hi = mid - 1;
+		}
+	}
+
+	return r;
+}
+
+static int bitset_sparse_container_test(bitset_sparse_container *c, uint32_t v) {
+	uint32_t i;
+	int32_t r;
+
+	switch (c->type) {
+	case BITSET_SPARSE_ARRAY:
+		i = bitset_sparse_array_lower_bound(c->data.array, c->used, v);
+		return i < c->used && c->data.array[i] == v;
+	case BITSET_SPARSE_BITMAP:
+		return (c->data.bitmap[v >> 6] >> (v & 63)) & 1;
+	case BITSET_SPARSE_RUN:
+		r = bitset_sparse_run_find(c, v);
+		return r >= 0 && v <= (uint32_t)c->data.array[2 * r] + c->data.array[2 * r + 1];
+	}
+
+	return 0;
+}
+
+/**
+ * 容器中第一个不小于v的置位
+ *
+ * @return 块内的低16位，没有时返回-1
+ */
+static int32_t bitset_sparse_container_next(bitset_sparse_container *c, uint32_t v) {
+	uint32_t i, start, end;
+	uint64_t w;
+	int32_t r;
+
+	switch (c->type) {
+	case BITSET_SPARSE_ARRAY:
+		i = bitset_sparse_array_lower_bound(c->data.array, c->used, v);
+		return i < c->used ? c->data.array[i] : -1;
+	case BITSET_SPARSE_BITMAP:
+		i = v >> 6;
+		w = c->data.bitmap[i] & (~(uint64_t)0 << (v & 63));
+		for (;;) {
+			if (w) return (int32_t)(i * 64 + bitset_sparse_ctz64(w));
+			if (++i == BITSET_SPARSE_BITMAP_WORDS) return -1;
+			w = c->data.bitmap[i];
+		}
+	case BITSET_SPARSE_RUN:
+		r = bitset_sparse_run_find(c, v);
+		if (r >= 0) {
+			start = c->data.array[2 * r];
+			end = start + c->data.array[2 * r + 1];
+			if (v <= end) return (int32_t)v;
+		}
+		r++;
+		return (uint32_t)r < c->used ? c->data.array[2 * r] : -1;
+	}
+
+	return -1;
+}
+
+/**
+ * 转为bitmap容器
+ */
+static void bitset_sparse_to_bitmap(bitset_sparse_container *c) {
+	uint64_t *bm;
+	uint32_t i, v, end;
+
+	bm = calloc(BITSET_SPARSE_BITMAP_WORDS, sizeof(*bm));
+	assert(bm);
+
+	if (c->type == BITSET_SPARSE_ARRAY) {
+		for (i = 0; i < c->used; i++) {
+			v = c->data.array[i];
+			bm[v >> 6] |= (uint64_t)1 << (v & 63);
+		}
+	} else {
+		for (i = 0; i < c->used; i++) {
+			v = c->data.array[2 * i];
+			end = v + c->data.array[2 * i + 1];
+			for (; v <= end; v++) {
+				bm[v >> 6] |= (uint64_t)1 << (v & 63);
+			}
+		}
+	}
+
+	free(c->data.array);
+	c->data.bitmap = bm;
+	c->type = BITSET_SPARSE_BITMAP;
+	c->used = c->size = 0;
+}
+
+/**
+ * 转为array容器，c->card不能超过BITSET_SPARSE_ARRAY_MAX
+ */
+static void bitset_sparse_to_array(bitset_sparse_container *c) {
+	uint16_t *a;
+	uint32_t n = 0, size;
+	int32_t v;
+
+	assert(c->card <= BITSET_SPARSE_ARRAY_MAX);
+
+	size = c->card ? c->card : 1;
+	a = malloc(size * sizeof(*a));
+	assert(a);
+
+	for (v = bitset_sparse_container_next(c, 0); v >= 0;
+	     v = v < 0xffff ? bitset_sparse_container_next(c, v + 1) : -1) {
+		a[n++] = (uint16_t)v;
+	}
+	assert(n == c->card);
+
+	bitset_sparse_container_free(c);
+	c->data.array = a;
+	c->type = BITSET_SPARSE_ARRAY;
+	c->used = n;
+	c->size = size;
+}
+
+/**
+ * 转为有nruns段的run容器
+ */
+static void bitset_sparse_to_run(bitset_sparse_container *c, uint32_t nruns) {
+	uint16_t *runs;
+	uint32_t n = 0;
+	int32_t v, start, last;
+
+	runs = malloc(2 * nruns * sizeof(*runs));
+	assert(runs);
+
+	v = bitset_sparse_container_next(c, 0);
+	while (v >= 0) {
+		start = last = v;
+		for (;;) {
+			v = last < 0xffff ? bitset_sparse_container_next(c, last + 1) : -1;
+			if (v != last + 1) break;
+			last = v;
+		}
+		runs[n++] = (uint16_t)start;
+		runs[n++] = (uint16_t)(last - start);
+	}
+	assert(n == 2 * nruns);
+
+	bitset_sparse_container_free(c);
+	c->data.array = runs;
+	c->type = BITSET_SPARSE_RUN;
+	c->used = nruns;
+	c->size = n;
+}
+
+/**
+ * run容器被修改之前先按密度展开成array或bitmap
+ */
+static void bitset_sparse_expand_run(bitset_sparse_container *c) {
+	if (c->card > BITSET_SPARSE_ARRAY_MAX) {
+		bitset_sparse_to_bitmap(c);
+	} else {
+		bitset_sparse_to_array(c);
+	}
+}
+
+/**
+ * 将压缩位集合的第pos位置位
+ *
+ * array容器满了之后转为bitmap
+ */
+void bitset_sparse_set_bit(bitset_sparse *set, size_t pos) {
+	bitset_sparse_container *c;
+	uint32_t v = BITSET_SPARSE_LOW(pos), i;
+	uint64_t *w;
+
+	c = bitset_sparse_get_or_create(set, BITSET_SPARSE_KEY(pos));
+
+	if (c->type == BITSET_SPARSE_RUN) {
+		if (bitset_sparse_container_test(c, v)) return;
+		bitset_sparse_expand_run(c);
+	}
+
+	if (c->type == BITSET_SPARSE_ARRAY) {
+		i = bitset_sparse_array_lower_bound(c->data.array, c->used, v);
+		if (i < c->used && c->data.array[i] == v) return;
+
+		if (c->used < BITSET_SPARSE_ARRAY_MAX) {
+			if (c->used == c->size) {
+				c->size = c->size ? c->size * 2 : 4;
+				if (c->size > BITSET_SPARSE_ARRAY_MAX) c->size = BITSET_SPARSE_ARRAY_MAX;
+				c->data.array = realloc(c->data.array, c->size * sizeof(*c->data.array));
+				assert(c->data.array);
+			}
+
+			memmove(c->data.array + i + 1, c->data.array + i, (c->used - i) * sizeof(*c->data.array));
+			c->data.array[i] = (uint16_t)v;
+			c->used++;
+			c->card++;
+			return;
+		}
+
+		bitset_sparse_to_bitmap(c);
+	}
+
+	w = &c->data.bitmap[v >> 6];
+	if (!(*w & ((uint64_t)1 << (v & 63)))) {
+		*w |= (uint64_t)1 << (v & 63);
+		c->card++;
+	}
+}
+
+/**
+ * 将压缩位集合的第pos位清零
+ *
+ * bitmap容器降到BITSET_SPARSE_ARRAY_MAX的一半时才转回array，
+ * 避免在边界附近反复置位清零时来回转换；容器空了就释放
+ */
+void bitset_sparse_clear_bit(bitset_sparse *set, size_t pos) {
+	bitset_sparse_container *c;
+	uint32_t v = BITSET_SPARSE_LOW(pos), i;
+	uint64_t *w;
+
+	c = bitset_sparse_get_container(set, BITSET_SPARSE_KEY(pos));
+	if (NULL == c) return;
+	if (!bitset_sparse_container_test(c, v)) return;
+
+	if (c->type == BITSET_SPARSE_RUN) bitset_sparse_expand_run(c);
+
+	if (c->type == BITSET_SPARSE_ARRAY) {
+		i = bitset_sparse_array_lower_bound(c->data.array, c->used, v);
+		memmove(c->data.array + i, c->data.array + i + 1, (c->used - i - 1) * sizeof(*c->data.array));
+		c->used--;
+		c->card--;
+	} else {
+		w = &c->data.bitmap[v >> 6];
+		*w &= ~((uint64_t)1 << (v & 63));
+		c->card--;
+
+		if (c->card <= BITSET_SPARSE_ARRAY_MAX / 2) bitset_sparse_to_array(c);
+	}
+
+	if (0 == c->card) bitset_sparse_remove_container(set, c);
+}
+
+int bitset_sparse_test_bit(bitset_sparse *set, size_t pos) {
+	bitset_sparse_container *c;
+
+	c = bitset_sparse_get_container(set, BITSET_SPARSE_KEY(pos));
+
+	return c ? bitset_sparse_container_test(c, BITSET_SPARSE_LOW(pos)) : 0;
+}
+
+/**
+ * 从pos开始第一个置位的位
+ *
+ * 容器都不为空，所以最多只需要看两个容器
+ */
+size_t bitset_sparse_find_next_set(bitset_sparse *set, size_t pos) {
+	size_t key = BITSET_SPARSE_KEY(pos), i;
+	int32_t v;
+
+	for (i = bitset_sparse_lower_bound(set, key); i < set->used; i++) {
+		v = bitset_sparse_container_next(&set->c[i], set->c[i].key == key ? BITSET_SPARSE_LOW(pos) : 0);
+		if (v >= 0) return (set->c[i].key << 16) | (size_t)v;
+	}
+
+	return BITSET_SPARSE_NONE;
+}
+
+size_t bitset_sparse_find_first_set(bitset_sparse *set) {
+	return bitset_sparse_find_next_set(set, 0);
+}
+
+size_t bitset_sparse_popcount(bitset_sparse *set) {
+	size_t i, n = 0;
+
+	for (i = 0; i < set->used; i++) {
+		n += set->c[i].card;
+	}
+
+	return n;
+}
+
+size_t bitset_sparse_memory_usage(bitset_sparse *set) {
+	size_t i, n;
+
+	n = sizeof(*set) + set->size * sizeof(*set->c);
+	for (i = 0; i < set->used; i++) {
+		if (set->c[i].type == BITSET_SPARSE_BITMAP) {
+			n += BITSET_SPARSE_BITMAP_WORDS * sizeof(uint64_t);
+		} else {
+			n += set->c[i].size * sizeof(uint16_t);
+		}
+	}
+
+	return n;
+}
+
+/**
+ * 计算容器中连续置位的段数
+ *
+ * bitmap中一段的开头是自己为1而前一位为0的位，按字计算，
+ * 前一个字的最高位带到下一个字
+ */
+static uint32_t bitset_sparse_count_runs(bitset_sparse_container *c) {
+	uint32_t i, n = 0;
+	uint64_t w, carry = 0;
+
+	switch (c->type) {
+	case BITSET_SPARSE_ARRAY:
+		for (i = 0; i < c->used; i++) {
+			if (i == 0 || c->data.array[i] != c->data.array[i - 1] + 1) n++;
+		}
+		break;
+	case BITSET_SPARSE_BITMAP:
+		for (i = 0; i < BITSET_SPARSE_BITMAP_WORDS; i++) {
+			w = c->data.bitmap[i];
+			n += bitset_sparse_popcount64(w & ~((w << 1) | carry));
+			carry = w >> 63;
+		}
+		break;
+	case BITSET_SPARSE_RUN:
+		n = c->used;
+		break;
+	}
+
+	return n;
+}
+
+/**
+ * 把每个容器转为最小的表示
+ *
+ * 分别计算三种表示的大小：array为每个置位2字节，bitmap固定8KB，
+ * run为每段4字节，选最小的一种。array会顺便释放多分配的空间。
+ * 修改会展开run容器，大量置位之后调用一次即可
+ */
+void bitset_sparse_optimize(bitset_sparse *set) {
+	bitset_sparse_container *c;
+	size_t i, array_bytes, bitmap_bytes, run_bytes;
+	uint32_t nruns;
+
+	bitmap_bytes = BITSET_SPARSE_BITMAP_WORDS * sizeof(uint64_t);
+
+	for (i = 0; i < set->used; i++) {
+		c = &set->c[i];
+
+		nruns = bitset_sparse_count_runs(c);
+		run_bytes = nruns * 2 * sizeof(uint16_t);
+		array_bytes = c->card <= BITSET_SPARSE_ARRAY_MAX ? c->card * sizeof(uint16_t) : bitmap_bytes + 1;
+
+		if (run_bytes < array_bytes && run_bytes < bitmap_bytes) {
+			if (c->type != BITSET_SPARSE_RUN) bitset_sparse_to_run(c, nruns);
+		} else if (array_bytes <= bitmap_bytes) {
+			/* 也用来收缩array多分配的空间 */
+			if (c->type != BITSET_SPARSE_ARRAY || c->size != c->used) bitset_sparse_to_array(c);
+		} else if (c->type != BITSET_SPARSE_BITMAP) {
+			bitset_sparse_to_bitmap(c);
+		}
+	}
+
+	if (0 == set->used) {
+		free(set->c);
+		set->c = NULL;
+		set->size = 0;
+	} else if (set->size > set->used) {
+		set->size = set->used;
+		set->c = realloc(set->c, set->size * sizeof(*set->c));
+		assert(set->c);
+	}
+}
+
+/**
+ * 由密集的bitset建立压缩位集合
+ *
+ * 按顺序置位，每次都追加在容器的末尾，不需要移动数据。
+ * 建立之后调用一次bitset_sparse_optimize选出最小的表示
+ *
+ * @param src 原来的bitset，不会被修改
+ *
+ * @return 新的压缩位集合
+ */
+bitset_sparse *bitset_sparse_from_bitset(bitset *src) {
+	bitset_sparse *set = bitset_sparse_init();
+	size_t i;
+
+	for (i = bitset_find_first_set(src); i < src->nbits; i = bitset_find_next_set(src, i + 1)) {
+		bitset_sparse_set_bit(set, i);
+	}
+
+	bitset_sparse_optimize(set);
+
+	return set;
+}
+
+/**
+ * 转为密集的bitset，id空间变得密集之后使用
+ *
+ * @param set 压缩位集合，不会被修改
+ * @param nbits 新bitset的位数，必须大于最大的id；为0时取最大的id加1
+ *
+ * @return 新的bitset
+ */
+bitset *bitset_sparse_to_bitset(bitset_sparse *set, size_t nbits) {
+	bitset *b;
+	size_t i, max = 0;
+	int32_t v;
+
+	/* 最大的id在最后一个容器的最后一个置位 */
+	if (set->used) {
+		bitset_sparse_container *c = &set->c[set->used - 1];
+
+		for (v = bitset_sparse_container_next(c, 0); v >= 0;
+		     v = v < 0xffff ? bitset_sparse_container_next(c, v + 1) : -1) {
+			max = (c->key << 16) | (size_t)v;
+		}
+		if (nbits == 0) nbits = max + 1;
+		assert(nbits > max);
+	}
+
+	b = bitset_init(nbits);
+
+	for (i = bitset_sparse_find_first_set(set); i != BITSET_SPARSE_NONE; i = bitset_sparse_find_next_set(set, i + 1)) {
+		bitset_set_bit(b, i);
+	}
+
+	return b;
+}
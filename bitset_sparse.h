@@ -0,0 +1,90 @@
+#ifndef _BITSET_SPARSE_H_
+#define _BITSET_SPARSE_H_
+
+#include "bitset.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * 压缩的位集合，用于很大而稀疏的id空间
+ *
+ * 做法和roaring bitmap相同：id的高位作为key，把id空间分成
+ * 2^16个一块，每块用一个容器保存低16位，没有置位的块不占内存。
+ * 容器有三种，按块内的密度自动选择：
+ *
+ *  array  有序的uint16_t数组，每个置位2字节，块内不超过4096个时使用
+ *  bitmap 65536位的位图，固定8KB，块内置位多时使用
+ *  run    [start, start + len]的段组成的有序数组，每段4字节，
+ *         连续分配的id压缩得最好，由bitset_sparse_optimize选出
+ *
+ * 置位和清零时array和bitmap之间自动转换；run容器被修改时先展开，
+ * 之后再调用bitset_sparse_optimize重新压缩
+ *
+ * 和bitset不同，这里没有固定的大小，任何size_t的id都可以置位
+ *
+ * 为什么是单独的类型而不是放在bitset_*后面:bitset的单个位操作是
+ * static inline，直接按下标访问bits[]，bloom等热路径上的探测只有
+ * 一次取字；整体操作要求两边nbits相同、逐字进行；summary和数据
+ * 在同一块对齐的内存中。把容器放到bitset后面，每次bitset_test_bit
+ * 都要多一次类型判断和一次指针跳转，密集的位集合白白变慢。
+ * 所以两种表示由调用者在建立时按预计的密度选择，函数名一一对应，
+ * 运行中密度变了可以用bitset_sparse_from_bitset/bitset_sparse_to_bitset
+ * 在两者之间转换
+ */
+
+#define BITSET_SPARSE_ARRAY_MAX 4096  /* array容器最多的元素个数，再多就比bitmap大了 */
+#define BITSET_SPARSE_BITMAP_WORDS (65536 / 64)
+
+#define BITSET_SPARSE_NONE ((size_t)-1) /* 查找不到时的返回值 */
+
+typedef enum {
+	BITSET_SPARSE_ARRAY,
+	BITSET_SPARSE_BITMAP,
+	BITSET_SPARSE_RUN
+} bitset_sparse_type;
+
+typedef struct {
+	size_t key;             /* id >> 16 */
+	bitset_sparse_type type;
+
+	uint32_t card;          /* 块内置位的个数 */
+	uint32_t used;          /* array为元素个数，run为段数 */
+	uint32_t size;          /* array和run已分配的uint16_t个数 */
+
+	union {
+		uint16_t *array;    /* array的元素，run的(start, len)对 */
+		uint64_t *bitmap;
+	} data;
+} bitset_sparse_container;
+
+typedef struct {
+	bitset_sparse_container *c; /* 按key排序 */
+	size_t used;
+	size_t size;
+} bitset_sparse;
+
+bitset_sparse *bitset_sparse_init(void);     /* 定义一个空的压缩位集合对象 */
+void bitset_sparse_reset(bitset_sparse *set); /* 清空，释放所有容器 */
+void bitset_sparse_free(bitset_sparse *set);  /* 释放一个压缩位集合对象所占内存 */
+
+void bitset_sparse_set_bit(bitset_sparse *set, size_t pos);
+void bitset_sparse_clear_bit(bitset_sparse *set, size_t pos);
+int bitset_sparse_test_bit(bitset_sparse *set, size_t pos);
+
+/**
+ * 没有找到时返回BITSET_SPARSE_NONE，遍历所有置位的位:
+ *
+ *	for (i = bitset_sparse_find_first_set(set); i != BITSET_SPARSE_NONE; i = bitset_sparse_find_next_set(set, i + 1))
+ */
+size_t bitset_sparse_find_first_set(bitset_sparse *set);
+size_t bitset_sparse_find_next_set(bitset_sparse *set, size_t pos);
+
+size_t bitset_sparse_popcount(bitset_sparse *set);     /* 置位的位数 */
+size_t bitset_sparse_memory_usage(bitset_sparse *set); /* 占用的字节数，用于统计 */
+void bitset_sparse_optimize(bitset_sparse *set);       /* 把每个容器转为最小的表示，连续的id会压缩成run */
+
+bitset_sparse *bitset_sparse_from_bitset(bitset *src);            /* 由密集的bitset建立，并压缩 */
+bitset *bitset_sparse_to_bitset(bitset_sparse *set, size_t nbits); /* 转为nbits位的bitset，0表示按最大的id */
+
+#endif
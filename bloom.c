@@ -0,0 +1,192 @@
+
+/**
+ * 记住一条:Bloom过滤器只会多报，不会漏报。
+ * 用作"已知不存在的路径"的缓存时，文件被创建后要
+ * 及时删除(计数型)或重建，否则会一直被当作不存在
+ */
+
+#include "bloom.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <math.h>
+
+/**
+ * 散列函数个数的上限，再多只会增加每次查询的开销
+ */
+#define BLOOM_MAX_K 16
+
+/**
+ * 由一个64位散列值得到第i个散列函数的结果
+ *
+ * 按Kirsch-Mitzenmacher的方法，用两个散列值的线性组合
+ * h1 + i * h2 模拟k个独立的散列函数，只需散列一次key
+ */
+#define BLOOM_POS(bf, h1, h2, i) \
+	( ((h1) + (i) * (h2)) % (bf)->bits->nbits )
+
+/**
+ * 初始化一个Bloom过滤器
+ *
+ * 根据预计的元素个数n和误判率p计算位数m和散列函数个数k:
+ * m = -n * ln(p) / (ln 2)^2，k = m / n * ln 2
+ *
+ * @param capacity 预计的元素个数
+ * @param fp_rate 期望的误判率，如0.01
+ * @param counting 为1时建立计数型的过滤器，支持删除
+ *
+ * @return 成功时返回bloom对象
+ */
+bloom *bloom_init(size_t capacity, double fp_rate, int counting) {
+	bloom *bf;
+	double m;
+	size_t nbits, k;
+
+	if (capacity == 0) capacity = 1;
+	if (fp_rate <= 0 || fp_rate >= 1) fp_rate = 0.01;
+
+	m = ceil(-(double)capacity * log(fp_rate) / (M_LN2 * M_LN2));
+	nbits = m < 64 ? 64 : (size_t)m;
+
+	k = (size_t)(m / capacity * M_LN2 + 0.5);
+	if (k < 1) k = 1;
+	if (k > BLOOM_MAX_K) k = BLOOM_MAX_K;
+
+	bf = malloc(sizeof(*bf));
+	assert(bf);
+
+	bf->bits = bitset_init(nbits);
+	bf->counters = NULL;
+	if (counting) {
+		bf->counters = calloc(nbits, sizeof(*bf->counters));
+		assert(bf->counters);
+	}
+
+	bf->k = k;
+	bf->capacity = capacity;
+	bf->count = 0;
+
+	return bf;
+}
+
+/**
+ * 释放Bloom过滤器所用的内存
+ */
+void bloom_free(bloom *bf) {
+	if (!bf) return;
+
+	bitset_free(bf->bits);
+	free(bf->counters);
+	free(bf);
+}
+
+/**
+ * 清空Bloom过滤器
+ *
+ * 没有删除操作的过滤器只能通过清空后重新插入来去掉
+ * 过期的元素，一般在bloom_need_rebuild返回1时进行
+ */
+void bloom_reset(bloom *bf) {
+	bitset_reset(bf->bits);
+	if (bf->counters) {
+		memset(bf->counters, 0, bf->bits->nbits * sizeof(*bf->counters));
+	}
+	bf->count = 0;
+}
+
+/**
+ * 插入一个元素
+ *
+ * 计数型过滤器的计数器到255后不再增加，这样的位以后
+ * 也不会被删除，最多只是多报
+ *
+ * @param bf 过滤器
+ * @param key 要插入的元素
+ */
+void bloom_add(bloom *bf, buffer *key) {
+	uint64_t h = buffer_hash(key);
+	uint64_t h1 = h & 0xFFFFFFFF, h2 = (h >> 32) | 1;
+	size_t i, pos;
+
+	for (i = 0; i < bf->k; i++) {
+		pos = BLOOM_POS(bf, h1, h2, i);
+
+		bitset_set_bit(bf->bits, pos);
+		if (bf->counters && bf->counters[pos] < 255) {
+			bf->counters[pos]++;
+		}
+	}
+
+	bf->count++;
+}
+
+/**
+ * 判断一个元素是否可能在集合中
+ *
+ * @param bf 过滤器
+ * @param key 要判断的元素
+ *
+ * @return 可能在集合中返回1，一定不在返回0
+ */
+int bloom_test(bloom *bf, buffer *key) {
+	uint64_t h = buffer_hash(key);
+	uint64_t h1 = h & 0xFFFFFFFF, h2 = (h >> 32) | 1;
+	size_t i;
+
+	for (i = 0; i < bf->k; i++) {
+		if (!bitset_test_bit(bf->bits, BLOOM_POS(bf, h1, h2, i))) return 0;
+	}
+
+	return 1;
+}
+
+/**
+ * 从计数型过滤器中删除一个元素
+ *
+ * 只能删除插入过的元素，否则会影响其它元素的判断。
+ * 计数器减到0时清除对应的位
+ *
+ * @param bf 计数型过滤器
+ * @param key 要删除的元素
+ *
+ * @return 成功返回0，不是计数型过滤器或元素不在其中返回-1
+ */
+int bloom_remove(bloom *bf, buffer *key) {
+	uint64_t h = buffer_hash(key);
+	uint64_t h1 = h & 0xFFFFFFFF, h2 = (h >> 32) | 1;
+	size_t i, pos;
+
+	if (!bf->counters) return -1;
+	if (!bloom_test(bf, key)) return -1;
+
+	for (i = 0; i < bf->k; i++) {
+		pos = BLOOM_POS(bf, h1, h2, i);
+
+		/* 饱和的计数器无法知道真实的次数，保留 */
+		if (bf->counters[pos] == 255) continue;
+
+		/* 计数已经为0说明并没有插入过，不能再减 */
+		if (bf->counters[pos] == 0) continue;
+
+		if (--bf->counters[pos] == 0) {
+			bitset_clear_bit(bf->bits, pos);
+		}
+	}
+
+	if (bf->count) bf->count--;
+
+	return 0;
+}
+
+/**
+ * 判断是否需要重建
+ *
+ * 插入的元素超过设计容量后误判率会迅速上升，
+ * 此时应bloom_reset后重新插入仍然有效的元素
+ *
+ * @return 需要重建返回1，否则返回0
+ */
+int bloom_need_rebuild(bloom *bf) {
+	return bf->count > bf->capacity;
+}
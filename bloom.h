@@ -0,0 +1,32 @@
+#ifndef _BLOOM_H_
+#define _BLOOM_H_
+
+#include "buffer.h"
+#include "bitset.h"
+
+/**
+ * 建立在bitset之上的Bloom过滤器
+ *
+ * 查询结果为"不在集合中"时一定正确，为"在集合中"时有
+ * fp_rate的概率是误判。计数型的过滤器还为每一位配一个
+ * 计数器，从而支持删除
+ */
+typedef struct {
+	bitset *bits;
+	unsigned char *counters; /* 计数型过滤器中每一位的计数，否则为NULL */
+
+	size_t k;        /* 散列函数的个数 */
+	size_t capacity; /* 按fp_rate设计的元素个数 */
+	size_t count;    /* 已经插入的元素个数 */
+} bloom;
+
+bloom *bloom_init(size_t capacity, double fp_rate, int counting); /* 定义一个Bloom过滤器 */
+void bloom_free(bloom *bf);   /* 释放Bloom过滤器 */
+void bloom_reset(bloom *bf);  /* 清空，重建前调用 */
+
+void bloom_add(bloom *bf, buffer *key);    /* 插入一个元素 */
+int bloom_test(bloom *bf, buffer *key);    /* 判断一个元素是否可能在集合中 */
+int bloom_remove(bloom *bf, buffer *key);  /* 删除一个元素，只用于计数型过滤器 */
+int bloom_need_rebuild(bloom *bf);         /* 插入的元素超过设计容量时需要重建 */
+
+#endif
@@ -13,6 +13,14 @@
 #include <assert.h>
 #include <ctype.h>
 
+#ifdef BUFFER_THREAD_CACHE
+# if !defined(__STDC_VERSION__) || __STDC_VERSION__ < 201112L || defined(__STDC_NO_ATOMICS__)
+#  error "BUFFER_THREAD_CACHE needs C11 atomics"
+# endif
+# include <pthread.h>
+# include <stdatomic.h>
+#endif
+
 
 
 static const char hex_chars[] = "0123456789abcdef";
@@ -25,6 +33,177 @@ static const char hex_chars[] = "0123456789abcdef";
  */
 
 
+#ifdef BUFFER_THREAD_CACHE
+/**
+ * 每个线程的buffer缓存
+ *
+ * 打开BUFFER_THREAD_CACHE时，每个buffer前面有一个buffer_cache_hdr，
+ * 记录它是哪个线程的缓存分配的。释放时如果就是当前线程，
+ * 连同不太大的ptr一起放回缓存，不经过malloc；否则放进所属线程
+ * 的远程释放链表，由那个线程下次分配时取回。
+ * 这样多个线程之间没有锁，也不争用malloc
+ *
+ * 线程退出时它的缓存不能马上释放，其它线程可能还持有从这里
+ * 分配的buffer。live记录这些buffer的个数(加上线程自己的1)，
+ * 减到0的一方释放缓存
+ */
+#define BUFFER_THREAD_CACHE_MAX 256 /* 每个线程最多缓存的buffer个数 */
+
+struct buffer_thread_cache;
+
+typedef struct buffer_cache_hdr {
+	struct buffer_thread_cache *owner;
+	struct buffer_cache_hdr *next;
+} buffer_cache_hdr;
+
+typedef struct buffer_thread_cache {
+	buffer_cache_hdr *free_list; /* 只有所属线程访问 */
+	size_t nfree;
+
+	_Atomic(buffer_cache_hdr *) remote; /* 其它线程释放的buffer */
+	atomic_size_t live;
+	atomic_int dead;
+} buffer_thread_cache;
+
+static __thread buffer_thread_cache *buffer_tc;
+static pthread_key_t buffer_tc_key;
+static pthread_once_t buffer_tc_once = PTHREAD_ONCE_INIT;
+
+#define BUFFER_CACHE_HDR(b) ((buffer_cache_hdr *)(b) - 1)
+#define BUFFER_CACHE_BUF(h) ((buffer *)((h) + 1))
+
+/**
+ * 真正释放一个buffer，所属的缓存没有buffer了也一起释放
+ */
+static void buffer_cache_release(buffer_cache_hdr *h) {
+	buffer_thread_cache *tc = h->owner;
+
+	free(BUFFER_CACHE_BUF(h)->ptr);
+	free(h);
+
+	if (1 == atomic_fetch_sub(&tc->live, 1)) free(tc);
+}
+
+/**
+ * 释放链表中的所有buffer
+ */
+static void buffer_cache_release_list(buffer_cache_hdr *h) {
+	buffer_cache_hdr *next;
+
+	for (; h; h = next) {
+		next = h->next;
+		buffer_cache_release(h);
+	}
+}
+
+/**
+ * 线程退出时调用，释放缓存中的buffer
+ */
+static void buffer_tc_destroy(void *arg) {
+	buffer_thread_cache *tc = arg;
+
+	/* 先标记，之后远程释放的一方会自己清理 */
+	atomic_store(&tc->dead, 1);
+
+	buffer_cache_release_list(tc->free_list);
+	tc->free_list = NULL;
+	buffer_cache_release_list(atomic_exchange(&tc->remote, NULL));
+
+	if (1 == atomic_fetch_sub(&tc->live, 1)) free(tc);
+}
+
+static void buffer_tc_key_init(void) {
+	pthread_key_create(&buffer_tc_key, buffer_tc_destroy);
+}
+
+static buffer_thread_cache *buffer_tc_get(void) {
+	buffer_thread_cache *tc;
+
+	if (NULL != (tc = buffer_tc)) return tc;
+
+	tc = calloc(1, sizeof(*tc));
+	assert(tc);
+	atomic_init(&tc->remote, NULL);
+	atomic_init(&tc->live, 1);
+	atomic_init(&tc->dead, 0);
+
+	pthread_once(&buffer_tc_once, buffer_tc_key_init);
+	pthread_setspecific(buffer_tc_key, tc);
+
+	return buffer_tc = tc;
+}
+
+/**
+ * 把buffer放进所属线程的远程释放链表
+ */
+static void buffer_cache_remote_free(buffer_cache_hdr *h) {
+	buffer_thread_cache *tc = h->owner;
+	buffer_cache_hdr *head;
+
+	/* h还没有释放，live不会为0，这里访问tc是安全的 */
+	if (atomic_load(&tc->dead)) {
+		buffer_cache_release(h);
+		return;
+	}
+
+	/**
+	 * h放进链表之后随时可能被所属线程退出时释放，live随之减到0，
+	 * tc被释放。先加上一个引用，下面再检查dead时tc仍然有效
+	 */
+	atomic_fetch_add(&tc->live, 1);
+
+	head = atomic_load(&tc->remote);
+	do {
+		h->next = head;
+	} while (!atomic_compare_exchange_weak(&tc->remote, &head, h));
+
+	/**
+	 * 所属线程可能在这期间退出了，它最后一次取远程链表
+	 * 之后放进来的只能由放的一方清理
+	 */
+	if (atomic_load(&tc->dead)) {
+		buffer_cache_release_list(atomic_exchange(&tc->remote, NULL));
+	}
+
+	if (1 == atomic_fetch_sub(&tc->live, 1)) free(tc);
+}
+
+buffer* buffer_init(void) {
+	buffer_thread_cache *tc = buffer_tc_get();
+	buffer_cache_hdr *h;
+	buffer *b;
+
+	if (tc->free_list == NULL) {
+		tc->free_list = atomic_exchange(&tc->remote, NULL);
+		for (h = tc->free_list, tc->nfree = 0; h; h = h->next) tc->nfree++;
+	}
+
+	if (NULL != (h = tc->free_list)) {
+		/* 复用缓存中的buffer，保留原来的ptr */
+		tc->free_list = h->next;
+		tc->nfree--;
+
+		b = BUFFER_CACHE_BUF(h);
+		if (b->size) b->ptr[0] = '\0';
+		b->used = 0;
+
+		return b;
+	}
+
+	h = malloc(sizeof(*h) + sizeof(*b));
+	assert(h);
+	h->owner = tc;
+	h->next = NULL;
+	atomic_fetch_add(&tc->live, 1);
+
+	b = BUFFER_CACHE_BUF(h);
+	b->ptr = NULL;
+	b->size = 0;
+	b->used = 0;
+
+	return b;
+}
+#else
 buffer* buffer_init(void) {
 	buffer *b;
 
@@ -37,6 +216,7 @@ buffer* buffer_init(void) {
 
 	return b;
 }
+#endif
 
 /**
  * 相当于C++里面的赋值初始化
@@ -56,8 +236,31 @@ buffer *buffer_init_buffer(buffer *src) {
 void buffer_free(buffer *b) {
 	if (!b) return; /* 不报错？ */
 
+#ifdef BUFFER_THREAD_CACHE
+	{
+		buffer_cache_hdr *h = BUFFER_CACHE_HDR(b);
+
+		/* 太大的ptr不缓存，和buffer_reset一样 */
+		if (b->size > li_tunables.buffer_max_reuse_size) {
+			free(b->ptr);
+			b->ptr = NULL;
+			b->size = 0;
+		}
+
+		if (h->owner != buffer_tc) {
+			buffer_cache_remote_free(h);
+		} else if (buffer_tc->nfree < BUFFER_THREAD_CACHE_MAX) {
+			h->next = buffer_tc->free_list;
+			buffer_tc->free_list = h;
+			buffer_tc->nfree++;
+		} else {
+			buffer_cache_release(h);
+		}
+	}
+#else
 	free(b->ptr);
 	free(b);
+#endif
 }
 
 /**
@@ -69,8 +272,17 @@ void buffer_free(buffer *b) {
 void buffer_reset(buffer *b) {
 	if (!b) return;
 
+#ifndef BUFFER_THREAD_CACHE
+	/**
+	 * 自动调整打开时，根据常见的大小调整复用的上限。
+	 * 打开BUFFER_THREAD_CACHE时buffer在多个线程中使用，
+	 * tunables_observe_buffer的状态和li_tunables都没有加锁，不做调整
+	 */
+	if (li_tunables.adaptive) tunables_observe_buffer(b->size);
+#endif
+
 	/* limit don't reuse buffer larger than ... bytes */
-	if (b->size > BUFFER_MAX_REUSE_SIZE) {
+	if (b->size > li_tunables.buffer_max_reuse_size) {
 		free(b->ptr);
 		b->ptr = NULL;
 		b->size = 0;
@@ -521,6 +733,134 @@ int buffer_copy_long(buffer *b, long val) {
 	return buffer_append_long(b, val);
 }
 
+/**
+ * RFC 1123格式的日期长度，如"Sun, 06 Nov 1994 08:49:37 GMT"，不含'\0'
+ */
+#define HTTP_DATE_LEN (sizeof("Sun, 06 Nov 1994 08:49:37 GMT") - 1)
+
+static const char http_date_days[] = "SunMonTueWedThuFriSat";
+static const char http_date_months[] = "JanFebMarAprMayJunJulAugSepOctNovDec";
+
+/**
+ * 当前秒的Date缓存，同一秒内的响应直接复用
+ */
+static time_t http_date_ts;
+static char http_date_str[HTTP_DATE_LEN + 1];
+
+/**
+ * 最近用到的mtime缓存，Last-Modified总是对同一批文件反复生成
+ */
+static struct {
+	time_t mtime;
+	char str[HTTP_DATE_LEN + 1];
+} mtime_cache[FILE_CACHE_MAX];
+static size_t mtime_cache_ndx;
+
+/**
+ * 将时间ts格式化成RFC 1123格式的日期
+ *
+ * 只调用gmtime_r分解时间，之后按固定宽度逐个字符填写，
+ * 不经过strftime，因而也不受locale的影响
+ *
+ * @param s 输出位置，至少HTTP_DATE_LEN + 1个字节
+ * @param ts 要格式化的时间
+ *
+ * @return 成功返回0，否则返回-1
+ */
+static int http_date_format(char *s, time_t ts) {
+	struct tm tm;
+	int year;
+
+	if (NULL == gmtime_r(&ts, &tm)) return -1;
+
+	year = tm.tm_year + 1900;
+	if (year < 0 || year > 9999) return -1;
+
+	memcpy(s, http_date_days + 3 * tm.tm_wday, 3);
+	s[3] = ',';
+	s[4] = ' ';
+	s[5] = '0' + tm.tm_mday / 10;
+	s[6] = '0' + tm.tm_mday % 10;
+	s[7] = ' ';
+	memcpy(s + 8, http_date_months + 3 * tm.tm_mon, 3);
+	s[11] = ' ';
+	s[12] = '0' + year / 1000;
+	s[13] = '0' + (year / 100) % 10;
+	s[14] = '0' + (year / 10) % 10;
+	s[15] = '0' + year % 10;
+	s[16] = ' ';
+	s[17] = '0' + tm.tm_hour / 10;
+	s[18] = '0' + tm.tm_hour % 10;
+	s[19] = ':';
+	s[20] = '0' + tm.tm_min / 10;
+	s[21] = '0' + tm.tm_min % 10;
+	s[22] = ':';
+	s[23] = '0' + tm.tm_sec / 10;
+	s[24] = '0' + tm.tm_sec % 10;
+	memcpy(s + 25, " GMT", 5); /* 连同'\0'一起复制 */
+
+	return 0;
+}
+
+/**
+ * 给buffer对象b追加Date头所用的日期
+ *
+ * 同一秒内只格式化一次，之后的调用直接从缓存中复制。
+ * 缓存是进程内静态的，和其它buffer函数一样不可多线程共用
+ *
+ * @param b 要追加到的buffer对象
+ * @param ts 当前时间，一般为srv->cur_ts
+ *
+ * @return 成功返回0，否则返回-1
+ */
+int buffer_append_http_date(buffer *b, time_t ts) {
+	if (!b) return -1;
+
+	if (ts != http_date_ts || http_date_str[0] == '\0') {
+		if (0 != http_date_format(http_date_str, ts)) {
+			http_date_str[0] = '\0';
+			return -1;
+		}
+		http_date_ts = ts;
+	}
+
+	return buffer_append_string_len(b, http_date_str, HTTP_DATE_LEN);
+}
+
+/**
+ * 给buffer对象b追加Last-Modified头所用的日期
+ *
+ * 在FILE_CACHE_MAX个最近用过的mtime中查找，命中则直接复制，
+ * 否则按轮转的方式替换其中一项
+ *
+ * @param b 要追加到的buffer对象
+ * @param mtime 文件的修改时间
+ *
+ * @return 成功返回0，否则返回-1
+ */
+int buffer_append_mtime(buffer *b, time_t mtime) {
+	size_t i;
+
+	if (!b) return -1;
+
+	for (i = 0; i < FILE_CACHE_MAX; i++) {
+		if (mtime_cache[i].str[0] != '\0' &&
+		    mtime_cache[i].mtime == mtime) {
+			return buffer_append_string_len(b, mtime_cache[i].str, HTTP_DATE_LEN);
+		}
+	}
+
+	i = mtime_cache_ndx;
+	if (0 != http_date_format(mtime_cache[i].str, mtime)) {
+		mtime_cache[i].str[0] = '\0';
+		return -1;
+	}
+	mtime_cache[i].mtime = mtime;
+	mtime_cache_ndx = (i + 1) % FILE_CACHE_MAX;
+
+	return buffer_append_string_len(b, mtime_cache[i].str, HTTP_DATE_LEN);
+}
+
 /**
  * 将off_t类型添加到buffer对象
  * 
@@ -724,6 +1064,31 @@ buffer *buffer_array_append_get_buffer(buffer_array *b) {
 	return b->ptr[b->used++];
 }
 
+/**
+ * 把read_buffer中未处理的数据[offset, used)移到开头
+ *
+ * 请求头的扫描断点hdr_scan随数据一起平移，部分匹配的状态保留，
+ * 之后的http_request_header_end从原来的位置继续
+ */
+void read_buffer_compact(read_buffer *rb) {
+	size_t len;
+
+	if (!rb || rb->offset == 0) return;
+
+	len = rb->used > rb->offset ? rb->used - rb->offset : 0;
+	if (len) memmove(rb->ptr, rb->ptr + rb->offset, len);
+
+	if (rb->hdr_scan >= rb->offset && rb->hdr_scan <= rb->used) {
+		rb->hdr_scan -= rb->offset;
+	} else {
+		rb->hdr_scan = 0;
+		rb->hdr_state = 0;
+	}
+
+	rb->offset = 0;
+	rb->used = len;
+}
+
 /**
  * 在buffer对象中搜匹配字符串前len个字符的位置
  *
@@ -909,6 +1274,48 @@ int buffer_caseless_compare(const char *a, size_t a_len, const char *b, size_t b
 }
 
 
+/**
+ * 计算一段内存的64位散列值
+ *
+ * 采用FNV-1a逐字节散列，最后再做一次混合(fmix64)，使得
+ * 高位和低位都足够随机，散列表和Bloom过滤器可以直接
+ * 截取其中的一部分使用
+ *
+ * @param s 要散列的内存
+ * @param len 内存的长度
+ *
+ * @return 64位的散列值
+ */
+uint64_t buffer_hash_len(const char *s, size_t len) {
+	const unsigned char *p = (const unsigned char *)s;
+	uint64_t h = 0xcbf29ce484222325ULL;
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		h ^= p[i];
+		h *= 0x100000001b3ULL;
+	}
+
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ULL;
+	h ^= h >> 33;
+
+	return h;
+}
+
+/**
+ * 计算buffer对象内容的散列值，不包括结尾的'\0'
+ *
+ * @return 64位的散列值
+ */
+uint64_t buffer_hash(buffer *b) {
+	if (!b || b->used == 0) return buffer_hash_len(NULL, 0);
+
+	return buffer_hash_len(b->ptr, b->used - 1);
+}
+
 /**
  * check if the rightmost bytes of the string are equal.
  */
@@ -1113,6 +1520,160 @@ const char encoded_chars_http_header[] = {
 };
 
 
+static const char base64_chars[] =
+	"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+/* base64字符到6bit值的映射，255表示非法字符 */
+static const unsigned char base64_reverse_table[] = {
+	/*
+	0    1    2    3    4    5    6    7    8    9    A    B    C    D    E    F
+	*/
+	255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,  /*  00 -  0F */
+	255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,  /*  10 -  1F */
+	255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,  62, 255, 255, 255,  63,  /*  20 -  2F */
+	 52,  53,  54,  55,  56,  57,  58,  59,  60,  61, 255, 255, 255, 255, 255, 255,  /*  30 -  3F */
+	255,   0,   1,   2,   3,   4,   5,   6,   7,   8,   9,  10,  11,  12,  13,  14,  /*  40 -  4F */
+	 15,  16,  17,  18,  19,  20,  21,  22,  23,  24,  25, 255, 255, 255, 255, 255,  /*  50 -  5F */
+	255,  26,  27,  28,  29,  30,  31,  32,  33,  34,  35,  36,  37,  38,  39,  40,  /*  60 -  6F */
+	 41,  42,  43,  44,  45,  46,  47,  48,  49,  50,  51, 255, 255, 255, 255, 255,  /*  70 -  7F */
+	255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,  /*  80 -  8F */
+	255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,  /*  90 -  9F */
+	255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,  /*  A0 -  AF */
+	255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,  /*  B0 -  BF */
+	255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,  /*  C0 -  CF */
+	255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,  /*  D0 -  DF */
+	255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,  /*  E0 -  EF */
+	255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,  /*  F0 -  FF */
+};
+
+/**
+ * 将字符串进行base64编码，并追加到buffer对象上
+ *
+ * 编码后的长度可以事先算出来，所以只调用一次buffer_prepare_append，
+ * 然后每3个字节一组查表输出4个字符，最后不足3个字节的部分用'='补齐
+ *
+ * @param b 要追加到的buffer对象
+ * @param s 要编码的内容
+ * @param s_len 内容的长度
+ *
+ * @return 成功返回0，否则返回-1
+ */
+static int buffer_append_base64_encode(buffer *b, const char *s, size_t s_len) {
+	const unsigned char *src = (const unsigned char *)s;
+	char *d;
+	size_t d_len, i;
+	unsigned int v;
+
+	/* BO protection */
+	if (s_len / 3 >= ((size_t)-1) / 4 - 1) return -1;
+
+	d_len = 4 * ((s_len + 2) / 3);
+
+	buffer_prepare_append(b, d_len + 1);
+	if (b->used == 0)
+		b->used++;
+	d = b->ptr + b->used - 1;
+
+	for (i = 0; i + 3 <= s_len; i += 3) {
+		v = (src[i] << 16) | (src[i + 1] << 8) | src[i + 2];
+
+		*(d++) = base64_chars[(v >> 18) & 0x3F];
+		*(d++) = base64_chars[(v >> 12) & 0x3F];
+		*(d++) = base64_chars[(v >> 6) & 0x3F];
+		*(d++) = base64_chars[v & 0x3F];
+	}
+
+	if (i < s_len) {
+		v = src[i] << 16;
+		if (i + 1 < s_len) v |= src[i + 1] << 8;
+
+		*(d++) = base64_chars[(v >> 18) & 0x3F];
+		*(d++) = base64_chars[(v >> 12) & 0x3F];
+		*(d++) = (i + 1 < s_len) ? base64_chars[(v >> 6) & 0x3F] : '=';
+		*(d++) = '=';
+	}
+
+	*d = '\0';
+	b->used += d_len;
+
+	return 0;
+}
+
+/**
+ * 对base64编码的字符串进行解码，并追加到buffer对象上
+ *
+ * 解码后的长度不超过 s_len / 4 * 3 + 3，因此也只需调用一次
+ * buffer_prepare_append。末尾的'='可以省略，但'='之后
+ * 不能再出现其它字符。解码的结果可能是二进制内容，
+ * 不过和buffer_append_string_len一样仍然以'\0'结尾
+ *
+ * @param b 要追加到的buffer对象
+ * @param s base64编码的字符串
+ * @param s_len 字符串的长度
+ *
+ * @return 成功返回0，含非法字符时返回-1，此时b的内容不变
+ */
+int buffer_append_base64_decode(buffer *b, const char *s, size_t s_len) {
+	const unsigned char *src = (const unsigned char *)s;
+	unsigned char *d;
+	unsigned char c;
+	size_t i, d_len = 0, used;
+	unsigned int v = 0;
+	int n = 0, pad = 0;
+
+	if (!s || !b) return -1;
+	if (s_len == 0) return 0;
+
+	used = b->used;
+	buffer_prepare_append(b, s_len / 4 * 3 + 3 + 1);
+	if (b->used == 0) {
+		b->used++;
+		b->ptr[0] = '\0';
+	}
+	d = (unsigned char *)b->ptr + b->used - 1;
+
+	for (i = 0; i < s_len; i++) {
+		if (src[i] == '=') {
+			/* 最多两个'='，且只能出现在一组的第3、4个位置 */
+			if (n < 2 || ++pad > 2) break;
+			continue;
+		}
+		if (pad) break;
+
+		c = base64_reverse_table[src[i]];
+		if (c == 255) break;
+
+		v = (v << 6) | c;
+		if (++n == 4) {
+			d[d_len++] = (v >> 16) & 0xFF;
+			d[d_len++] = (v >> 8) & 0xFF;
+			d[d_len++] = v & 0xFF;
+			v = 0;
+			n = 0;
+		}
+	}
+
+	if (i != s_len || n == 1 || (pad && n + pad != 4)) {
+		/* 非法输入，恢复原来的结尾 */
+		d[0] = '\0';
+		b->used = used;
+		return -1;
+	}
+
+	if (n == 2) {
+		d[d_len++] = (v >> 4) & 0xFF;
+	} else if (n == 3) {
+		d[d_len++] = (v >> 10) & 0xFF;
+		d[d_len++] = (v >> 2) & 0xFF;
+	}
+
+	d[d_len] = '\0';
+	b->used += d_len;
+
+	return 0;
+}
+
+
 /**
  * 根据提供的编码格式(buffer.h )对字符串进行编码，并添加到buffer对象
  *
@@ -1131,6 +1692,11 @@ int buffer_append_string_encoded(buffer *b, const char *s, size_t s_len, buffer_
 
 	if (s_len == 0) return 0;
 
+	if (encoding == ENCODING_BASE64) {
+	/* base64不是逐字符映射，不能查表，单独处理 */
+		return buffer_append_base64_encode(b, s, s_len);
+	}
+
 	switch(encoding) {
 	/* 选择编码表 */
 	case ENCODING_REL_URI:
@@ -1151,6 +1717,7 @@ int buffer_append_string_encoded(buffer *b, const char *s, size_t s_len, buffer_
 	case ENCODING_HTTP_HEADER:
 		map = encoded_chars_http_header;
 		break;
+	case ENCODING_BASE64:
 	case ENCODING_UNSET:
 		break;
 	}
@@ -1177,6 +1744,7 @@ int buffer_append_string_encoded(buffer *b, const char *s, size_t s_len, buffer_
 			case ENCODING_HEX:
 				d_len += 2;
 				break;
+			case ENCODING_BASE64:
 			case ENCODING_UNSET:
 				break;
 			}
@@ -1217,6 +1785,7 @@ int buffer_append_string_encoded(buffer *b, const char *s, size_t s_len, buffer_
 				d[d_len++] = *ds;
 				d[d_len++] = '\t';
 				break;
+			case ENCODING_BASE64:
 			case ENCODING_UNSET:
 				break;
 			}
@@ -1294,6 +1863,104 @@ int buffer_urldecode_query(buffer *url) {
 	return buffer_urldecode_internal(url, 1);
 }
 
+/**
+ * 判断一段内存是否为合法的UTF-8序列
+ *
+ * 按RFC 3629进行检查，拒绝过长编码(overlong)，代理区
+ * U+D800-U+DFFF以及大于U+10FFFF的码点。
+ * 纯ASCII部分一次取一个size_t，只要其中每个字节的最高位
+ * 都为0便整个跳过，这样路径和头部这类几乎全是ASCII的
+ * 内容只需很少的比较
+ *
+ * @param s 要检查的内存
+ * @param len 内存的长度
+ *
+ * @return 合法返回1，否则返回0
+ */
+int buffer_is_valid_utf8_len(const char *s, size_t len) {
+	const unsigned char *str = (const unsigned char *)s;
+	const size_t hi = ((size_t)-1 / 0xFF) * 0x80; /* 每个字节都是0x80 */
+	size_t i = 0, w;
+	unsigned char c, lo, up;
+	int n;
+
+	while (i < len) {
+		c = str[i];
+
+		if (c < 0x80) {
+			/* ASCII快速路径，memcpy避免了非对齐访问 */
+			while (i + sizeof(w) <= len) {
+				memcpy(&w, str + i, sizeof(w));
+				if (w & hi) break;
+				i += sizeof(w);
+			}
+			while (i < len && str[i] < 0x80) i++;
+			continue;
+		}
+
+		/**
+		 * 根据首字节确定后续字节数n，以及第二个字节的
+		 * 取值范围[lo, up]，借此排除过长编码和代理区
+		 */
+		lo = 0x80;
+		up = 0xBF;
+		if (c >= 0xC2 && c <= 0xDF) {
+			n = 1;
+		} else if (c >= 0xE0 && c <= 0xEF) {
+			n = 2;
+			if (c == 0xE0) lo = 0xA0;
+			if (c == 0xED) up = 0x9F;
+		} else if (c >= 0xF0 && c <= 0xF4) {
+			n = 3;
+			if (c == 0xF0) lo = 0x90;
+			if (c == 0xF4) up = 0x8F;
+		} else {
+			return 0;
+		}
+
+		if (len - i <= (size_t)n) return 0;
+
+		c = str[++i];
+		if (c < lo || c > up) return 0;
+
+		while (--n > 0) {
+			c = str[++i];
+			if ((c & 0xC0) != 0x80) return 0;
+		}
+		i++;
+	}
+
+	return 1;
+}
+
+/**
+ * 判断buffer对象的内容是否为合法的UTF-8
+ *
+ * @return 合法(或为空)返回1，否则返回0
+ */
+int buffer_is_valid_utf8(buffer *b) {
+	if (!b || b->used == 0) return 1;
+
+	return buffer_is_valid_utf8_len(b->ptr, b->used - 1);
+}
+
+/**
+ * 对路径进行url解码，并要求解码后的结果为合法的UTF-8
+ *
+ * 在访问文件系统之前就可以把非法的路径挡掉。
+ * 注意%00已经被buffer_urldecode_internal映射为'_'，
+ * 所以这里按字符串长度检查即可
+ *
+ * @param url 要解码的路径
+ *
+ * @return 成功返回0，解码失败或不是合法UTF-8返回-1
+ */
+int buffer_urldecode_path_utf8(buffer *url) {
+	if (0 != buffer_urldecode_internal(url, 0)) return -1;
+
+	return buffer_is_valid_utf8(url) ? 0 : -1;
+}
+
 /* Remove "/../", "//", "/./" parts from path.
  *
  * /blah/..         gets  /
@@ -1412,13 +2079,43 @@ int buffer_path_simplify(buffer *dest, buffer *src)
 	return 0;
 }
 
+/**
+ * 字符分类表，每个字符对应一组LIGHT_CTYPE_*标志位
+ *
+ * 用一次查表代替light_is*里的多次比较，解析请求头时
+ * 对每个字节都要做分类，这里省下的分支很可观。
+ * light_is*的参数是int，不在0-255之间的值(包括EOF)都返回0，
+ * 和原来逐个比较时一样
+ */
+const unsigned char light_ctype[] = {
+	/*
+	0     1     2     3     4     5     6     7     8     9     A     B     C     D     E     F
+	*/
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x20, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,  /*  00 -  0F */
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,  /*  10 -  1F */
+	0x20, 0x38, 0x30, 0x38, 0x38, 0x38, 0x38, 0x38, 0x30, 0x30, 0x38, 0x38, 0x30, 0x38, 0x38, 0x30,  /*  20 -  2F */
+	0x3b, 0x3b, 0x3b, 0x3b, 0x3b, 0x3b, 0x3b, 0x3b, 0x3b, 0x3b, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,  /*  30 -  3F */
+	0x30, 0x3e, 0x3e, 0x3e, 0x3e, 0x3e, 0x3e, 0x3c, 0x3c, 0x3c, 0x3c, 0x3c, 0x3c, 0x3c, 0x3c, 0x3c,  /*  40 -  4F */
+	0x3c, 0x3c, 0x3c, 0x3c, 0x3c, 0x3c, 0x3c, 0x3c, 0x3c, 0x3c, 0x3c, 0x30, 0x30, 0x30, 0x38, 0x38,  /*  50 -  5F */
+	0x38, 0x3e, 0x3e, 0x3e, 0x3e, 0x3e, 0x3e, 0x3c, 0x3c, 0x3c, 0x3c, 0x3c, 0x3c, 0x3c, 0x3c, 0x3c,  /*  60 -  6F */
+	0x3c, 0x3c, 0x3c, 0x3c, 0x3c, 0x3c, 0x3c, 0x3c, 0x3c, 0x3c, 0x3c, 0x30, 0x38, 0x30, 0x38, 0x00,  /*  70 -  7F */
+	0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,  /*  80 -  8F */
+	0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,  /*  90 -  9F */
+	0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,  /*  A0 -  AF */
+	0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,  /*  B0 -  BF */
+	0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,  /*  C0 -  CF */
+	0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,  /*  D0 -  DF */
+	0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,  /*  E0 -  EF */
+	0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,  /*  F0 -  FF */
+};
+
 /**
  * 判断int c是否为字符'0'到‘9’
  *
  * @return  是则返回1.否则返回0
  */
 int light_isdigit(int c) {
-	return (c >= '0' && c <= '9');
+	return (unsigned int)c < 256 && light_ctype_is(c, LIGHT_CTYPE_DIGIT) != 0;
 }
 
 /**
@@ -1427,10 +2124,7 @@ int light_isdigit(int c) {
  * @return  是则返回1.否则返回0
  */
 int light_isxdigit(int c) {
-	if (light_isdigit(c)) return 1;
-
-	c |= 32;
-	return (c >= 'a' && c <= 'f');
+	return (unsigned int)c < 256 && light_ctype_is(c, LIGHT_CTYPE_XDIGIT) != 0;
 }
 
 /**
@@ -1439,8 +2133,7 @@ int light_isxdigit(int c) {
  * @return  是则返回1.否则返回0
  */
 int light_isalpha(int c) {
-	c |= 32;
-	return (c >= 'a' && c <= 'z');
+	return (unsigned int)c < 256 && light_ctype_is(c, LIGHT_CTYPE_ALPHA) != 0;
 }
 
 /**
@@ -1449,7 +2142,7 @@ int light_isalpha(int c) {
  * @return  是则返回1.否则返回0
  */
 int light_isalnum(int c) {
-	return light_isdigit(c) || light_isalpha(c);
+	return (unsigned int)c < 256 && light_ctype_is(c, LIGHT_CTYPE_DIGIT | LIGHT_CTYPE_ALPHA) != 0;
 }
 
 /**
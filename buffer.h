@@ -20,6 +20,8 @@
 #include <stdlib.h>
 #include <sys/types.h>
 #include <stdio.h>
+#include <time.h>
+#include <stdint.h>
 
 /**
  * 定义基本的buffer结构及其数组表示
@@ -45,6 +47,13 @@ typedef struct {
 
 	size_t used;   /* output-pointer */
 	size_t size;
+
+	/**
+	 * 查找请求头结尾时的断点，保证每个字节只被看一次
+	 * 全部为0即为初始状态
+	 */
+	size_t hdr_scan;  /* 下次从ptr + hdr_scan开始扫描 */
+	int hdr_state;    /* 已匹配的行尾状态 */
 } read_buffer;
 
 buffer_array* buffer_array_init(void);
@@ -52,6 +61,8 @@ void buffer_array_free(buffer_array *b);
 void buffer_array_reset(buffer_array *b);
 buffer *buffer_array_append_get_buffer(buffer_array *b);
 
+void read_buffer_compact(read_buffer *rb);
+
 buffer* buffer_init(void);
 buffer* buffer_init_buffer(buffer *b);
 buffer* buffer_init_string(const char *str);
@@ -79,6 +90,9 @@ int buffer_append_string_rfill(buffer *b, const char *s, size_t maxlen);
 int buffer_append_long_hex(buffer *b, unsigned long len);
 int buffer_append_long(buffer *b, long val);
 
+int buffer_append_http_date(buffer *b, time_t ts);
+int buffer_append_mtime(buffer *b, time_t mtime);
+
 #if defined(SIZEOF_LONG) && (SIZEOF_LONG == SIZEOF_OFF_T)
 #define buffer_copy_off_t(x, y)		buffer_copy_long(x, y)
 #define buffer_append_off_t(x, y)	buffer_append_long(x, y)
@@ -97,6 +111,12 @@ int buffer_is_equal_right_len(buffer *a, buffer *b, size_t len);
 int buffer_is_equal_string(buffer *a, const char *s, size_t b_len);
 int buffer_caseless_compare(const char *a, size_t a_len, const char *b, size_t b_len);
 
+uint64_t buffer_hash_len(const char *s, size_t len);
+uint64_t buffer_hash(buffer *b);
+
+int buffer_is_valid_utf8(buffer *b);
+int buffer_is_valid_utf8_len(const char *s, size_t len);
+
 typedef enum {
 /* 定义了各种编码的类型 */
 	ENCODING_UNSET,
@@ -105,13 +125,16 @@ typedef enum {
 	ENCODING_HTML,         /* & becomes &amp; and so on */
 	ENCODING_MINIMAL_XML,  /* minimal encoding for xml */
 	ENCODING_HEX,          /* encode string as hex */
-	ENCODING_HTTP_HEADER   /* encode \n with \t\n */
+	ENCODING_HTTP_HEADER,  /* encode \n with \t\n */
+	ENCODING_BASE64        /* encode string as base64 (RFC 4648) */
 } buffer_encoding_t;
 
 int buffer_append_string_encoded(buffer *b, const char *s, size_t s_len, buffer_encoding_t encoding);
+int buffer_append_base64_decode(buffer *b, const char *s, size_t s_len);
 
 int buffer_urldecode_path(buffer *url);
 int buffer_urldecode_query(buffer *url);
+int buffer_urldecode_path_utf8(buffer *url);
 int buffer_path_simplify(buffer *dest, buffer *src);
 
 int buffer_to_lower(buffer *b);
@@ -122,6 +145,25 @@ int LI_ltostr(char *buf, long val);
 char hex2int(unsigned char c);
 char int2hex(char i);
 
+/**
+ * light_ctype[]中的字符分类标志
+ */
+#define LIGHT_CTYPE_DIGIT  0x01 /* 0-9 */
+#define LIGHT_CTYPE_XDIGIT 0x02 /* 0-9 A-F a-f */
+#define LIGHT_CTYPE_ALPHA  0x04 /* A-Z a-z */
+#define LIGHT_CTYPE_TCHAR  0x08 /* RFC 7230 token，方法名和头部名 */
+#define LIGHT_CTYPE_VCHAR  0x10 /* 可见字符及obs-text(0x80-0xFF)，uri */
+#define LIGHT_CTYPE_FIELD  0x20 /* VCHAR加上SP和HTAB，头部的值 */
+
+extern const unsigned char light_ctype[256];
+
+/**
+ * 只用于缓冲区中的字节，c按unsigned char取值。
+ * 参数为int的字符(可能是EOF或超出一个字节)用下面的light_is*
+ */
+#define light_ctype_is(c, flags) \
+	(light_ctype[(unsigned char)(c)] & (flags))
+
 int light_isdigit(int c);
 int light_isxdigit(int c);
 int light_isalpha(int c);
@@ -0,0 +1,237 @@
+#include "buffer_queue.h"
+
+#ifdef HAVE_BUFFER_QUEUE
+
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#ifdef __linux__
+# include <sys/eventfd.h>
+#endif
+
+/**
+ * 建立队列
+ *
+ * 格子i的序号为i时表示空闲，可以被位置为i的生产者使用；
+ * 为i + 1时表示有数据，可以被位置为i的消费者取走。
+ * 取走之后序号加上格子数，留给下一圈的生产者
+ *
+ * @param size 至少能放的buffer个数，向上取到2的幂
+ * @param notify 为1时建立eventfd(其它系统为管道)，放入时通知消费者
+ *
+ * @return 成功返回队列；size太大(取到2的幂会溢出，或格子数组的大小溢出)、
+ *         分配内存失败或建立通知的fd失败返回NULL
+ */
+buffer_queue *buffer_queue_init(size_t size, int notify) {
+	buffer_queue *q;
+	size_t n = 2, i;
+
+	/* 超过SIZE_MAX / 2时n左移到0，下面的循环不会结束 */
+	if (size > SIZE_MAX / 2 / sizeof(buffer_queue_cell)) return NULL;
+
+	while (n < size) n <<= 1;
+
+	if (0 != posix_memalign((void **)&q, BUFFER_QUEUE_CACHE_LINE, sizeof(*q))) return NULL;
+
+	if (NULL == (q->cells = malloc(n * sizeof(*q->cells)))) {
+		free(q);
+		return NULL;
+	}
+	q->mask = n - 1;
+
+	for (i = 0; i < n; i++) {
+		atomic_init(&q->cells[i].seq, i);
+		q->cells[i].b = NULL;
+	}
+	atomic_init(&q->enqueue_pos, 0);
+	atomic_init(&q->dequeue_pos, 0);
+	atomic_init(&q->notify_pending, 0);
+	q->notify_fd[0] = q->notify_fd[1] = -1;
+
+	if (notify) {
+#ifdef __linux__
+		q->notify_fd[0] = q->notify_fd[1] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		if (q->notify_fd[0] == -1) {
+			free(q->cells);
+			free(q);
+			return NULL;
+		}
+#else
+		if (-1 == pipe(q->notify_fd)) {
+			free(q->cells);
+			free(q);
+			return NULL;
+		}
+		for (i = 0; i < 2; i++) {
+			fcntl(q->notify_fd[i], F_SETFL, fcntl(q->notify_fd[i], F_GETFL) | O_NONBLOCK);
+			fcntl(q->notify_fd[i], F_SETFD, FD_CLOEXEC);
+		}
+#endif
+	}
+
+	return q;
+}
+
+void buffer_queue_free(buffer_queue *q) {
+	buffer *b;
+
+	if (!q) return;
+
+	while (NULL != (b = buffer_queue_pop(q))) buffer_free(b);
+
+	if (q->notify_fd[0] != -1) close(q->notify_fd[0]);
+	if (q->notify_fd[1] != -1 && q->notify_fd[1] != q->notify_fd[0]) close(q->notify_fd[1]);
+
+	free(q->cells);
+	free(q);
+}
+
+/**
+ * 放入之后通知消费者
+ *
+ * 消费者处理之前只通知一次，一批buffer也只有一次系统调用
+ */
+static void buffer_queue_notify(buffer_queue *q) {
+	uint64_t one = 1;
+
+	if (q->notify_fd[1] == -1) return;
+
+	/* 和buffer_queue_clear_notify中的fence配对，保证消费者不会漏掉刚放入的buffer */
+	atomic_thread_fence(memory_order_seq_cst);
+	if (atomic_exchange(&q->notify_pending, 1)) return;
+
+	while (-1 == write(q->notify_fd[1], &one, q->notify_fd[0] == q->notify_fd[1] ? sizeof(one) : 1) && errno == EINTR);
+}
+
+/**
+ * 放入最多n个buffer
+ *
+ * 从当前位置开始数出连续空闲的格子，然后用一次CAS把它们都占下。
+ * 数过的格子在CAS成功之前只可能被别的生产者占用，而那样的话
+ * 位置已经变了，CAS会失败，所以CAS成功时它们一定仍然空闲
+ *
+ * @return 放入的个数，按bs中的顺序，队列满时可能少于n
+ */
+size_t buffer_queue_push_batch(buffer_queue *q, buffer **bs, size_t n) {
+	buffer_queue_cell *cell;
+	size_t pos, k, i;
+	intptr_t diff;
+
+	if (n == 0) return 0;
+
+	pos = atomic_load_explicit(&q->enqueue_pos, memory_order_relaxed);
+	for (;;) {
+		for (k = 0; k < n && k <= q->mask; k++) {
+			cell = &q->cells[(pos + k) & q->mask];
+			if (atomic_load_explicit(&cell->seq, memory_order_acquire) != pos + k) break;
+		}
+
+		if (k == 0) {
+			cell = &q->cells[pos & q->mask];
+			diff = (intptr_t)atomic_load_explicit(&cell->seq, memory_order_acquire) - (intptr_t)pos;
+
+			/* 格子还没有被上一圈的消费者取走，队列满 */
+			if (diff < 0) return 0;
+
+			/* 被别的生产者抢先了，重新读位置 */
+			pos = atomic_load_explicit(&q->enqueue_pos, memory_order_relaxed);
+			continue;
+		}
+
+		if (atomic_compare_exchange_weak_explicit(&q->enqueue_pos, &pos, pos + k,
+				memory_order_relaxed, memory_order_relaxed)) break;
+	}
+
+	for (i = 0; i < k; i++) {
+		cell = &q->cells[(pos + i) & q->mask];
+		cell->b = bs[i];
+		atomic_store_explicit(&cell->seq, pos + i + 1, memory_order_release);
+	}
+
+	buffer_queue_notify(q);
+
+	return k;
+}
+
+/**
+ * 取出最多max个buffer，做法和buffer_queue_push_batch相同
+ *
+ * @return 取出的个数，队列空时为0
+ */
+size_t buffer_queue_pop_batch(buffer_queue *q, buffer **bs, size_t max) {
+	buffer_queue_cell *cell;
+	size_t pos, k, i;
+	intptr_t diff;
+
+	if (max == 0) return 0;
+
+	pos = atomic_load_explicit(&q->dequeue_pos, memory_order_relaxed);
+	for (;;) {
+		for (k = 0; k < max && k <= q->mask; k++) {
+			cell = &q->cells[(pos + k) & q->mask];
+			if (atomic_load_explicit(&cell->seq, memory_order_acquire) != pos + k + 1) break;
+		}
+
+		if (k == 0) {
+			cell = &q->cells[pos & q->mask];
+			diff = (intptr_t)atomic_load_explicit(&cell->seq, memory_order_acquire) - (intptr_t)(pos + 1);
+
+			/* 格子还没有被生产者写入，队列空 */
+			if (diff < 0) return 0;
+
+			pos = atomic_load_explicit(&q->dequeue_pos, memory_order_relaxed);
+			continue;
+		}
+
+		if (atomic_compare_exchange_weak_explicit(&q->dequeue_pos, &pos, pos + k,
+				memory_order_relaxed, memory_order_relaxed)) break;
+	}
+
+	for (i = 0; i < k; i++) {
+		cell = &q->cells[(pos + i) & q->mask];
+		bs[i] = cell->b;
+		cell->b = NULL;
+		atomic_store_explicit(&cell->seq, pos + i + q->mask + 1, memory_order_release);
+	}
+
+	return k;
+}
+
+int buffer_queue_push(buffer_queue *q, buffer *b) {
+	return buffer_queue_push_batch(q, &b, 1) == 1 ? 0 : -1;
+}
+
+buffer *buffer_queue_pop(buffer_queue *q) {
+	buffer *b;
+
+	return buffer_queue_pop_batch(q, &b, 1) == 1 ? b : NULL;
+}
+
+int buffer_queue_get_fd(buffer_queue *q) {
+	return q ? q->notify_fd[0] : -1;
+}
+
+/**
+ * 清除通知
+ *
+ * 先清除再取，清除之后放入的buffer会重新通知，
+ * 所以调用之后必须一直取到队列为空
+ */
+void buffer_queue_clear_notify(buffer_queue *q) {
+	char buf[64];
+
+	if (q->notify_fd[0] == -1) return;
+
+	/* 先读掉fd再清除标记，清除之后的通知会留在fd中 */
+	while (read(q->notify_fd[0], buf, sizeof(buf)) > 0) {
+		if (q->notify_fd[0] == q->notify_fd[1]) break;
+	}
+
+	atomic_store(&q->notify_pending, 0);
+	atomic_thread_fence(memory_order_seq_cst);
+}
+
+#endif
@@ -0,0 +1,54 @@
+#ifndef _BUFFER_QUEUE_H_
+#define _BUFFER_QUEUE_H_
+
+#include "buffer.h"
+
+#include <stddef.h>
+
+/**
+ * 在线程之间传递buffer的有界无锁队列
+ *
+ * 多个生产者多个消费者，按Dmitry Vyukov的做法，每个格子带一个
+ * 序号，生产者和消费者各自只争用一个位置计数。buffer放进队列
+ * 之后就归取出它的线程所有，放入的一方不能再访问它
+ *
+ * 依赖C11的<stdatomic.h>，编译器不支持时整个接口都不存在
+ */
+#if defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L && !defined(__STDC_NO_ATOMICS__)
+#define HAVE_BUFFER_QUEUE 1
+
+#include <stdatomic.h>
+
+#define BUFFER_QUEUE_CACHE_LINE 64
+
+typedef struct {
+	atomic_size_t seq;
+	buffer *b;
+} buffer_queue_cell;
+
+typedef struct {
+	buffer_queue_cell *cells;
+	size_t mask;            /* 格子数减1，格子数是2的幂 */
+
+	/* 两个位置分别被生产者和消费者争用，放在不同的cache line */
+	_Alignas(BUFFER_QUEUE_CACHE_LINE) atomic_size_t enqueue_pos;
+	_Alignas(BUFFER_QUEUE_CACHE_LINE) atomic_size_t dequeue_pos;
+
+	_Alignas(BUFFER_QUEUE_CACHE_LINE) atomic_int notify_pending; /* 已经通知过，消费者还没有处理 */
+	int notify_fd[2];       /* -1表示不通知，eventfd时两个相同 */
+} buffer_queue;
+
+buffer_queue *buffer_queue_init(size_t size, int notify);  /* 至少能放size个buffer，notify为1时建立通知的fd */
+void buffer_queue_free(buffer_queue *q);                     /* 释放队列和其中剩余的buffer，调用时不能有其它线程在使用 */
+
+int buffer_queue_push(buffer_queue *q, buffer *b);           /* 放入一个，满时返回-1 */
+buffer *buffer_queue_pop(buffer_queue *q);                   /* 取出一个，空时返回NULL */
+size_t buffer_queue_push_batch(buffer_queue *q, buffer **bs, size_t n);  /* 放入最多n个，返回放入的个数 */
+size_t buffer_queue_pop_batch(buffer_queue *q, buffer **bs, size_t max); /* 取出最多max个，返回取出的个数 */
+
+int buffer_queue_get_fd(buffer_queue *q);                    /* 通知的fd，可读表示有buffer放入 */
+void buffer_queue_clear_notify(buffer_queue *q);             /* fd可读时调用，之后应一直取到队列为空 */
+
+#endif
+
+#endif
@@ -0,0 +1,193 @@
+
+/**
+ * 记住一条:编码不碰数据，解码不分配内存
+ */
+
+#include "chunked.h"
+
+#include <string.h>
+
+/**
+ * 解码的状态
+ */
+enum {
+	CHUNKED_SIZE,        /* 读chunk-size的16进制数字 */
+	CHUNKED_SIZE_EXT,    /* 读chunk-ext，直到行尾 */
+	CHUNKED_SIZE_LF,     /* chunk-size行读到了'\r'，等待'\n' */
+	CHUNKED_DATA,        /* 读chunk的数据 */
+	CHUNKED_DATA_CR,     /* 数据之后的'\r' */
+	CHUNKED_DATA_LF,     /* 数据之后的'\n' */
+	CHUNKED_TRAILER,     /* trailer中一行的开头 */
+	CHUNKED_TRAILER_LINE,/* trailer中一行的中间 */
+	CHUNKED_TRAILER_LF,  /* 最后的空行读到了'\r'，等待'\n' */
+	CHUNKED_DONE
+};
+
+/**
+ * 生成一个chunk前面的框架
+ *
+ * 生成"<len的16进制>\r\n"，如果不是第一个chunk，前面再加上
+ * 结束上一个chunk的"\r\n"。这样两段数据之间只需要发送一小段b，
+ * 数据本身可以直接从原来的位置发送，不用复制到一起
+ *
+ * @param b 保存框架的buffer，原有内容被覆盖
+ * @param len 这个chunk的数据长度，不能为0
+ * @param first 是否是第一个chunk
+ *
+ * @return 成功返回0，否则返回-1
+ */
+int chunked_encode_chunk_header(buffer *b, size_t len, int first) {
+	if (!b || len == 0) return -1;
+
+	buffer_reset(b);
+	if (!first) BUFFER_APPEND_STRING_CONST(b, "\r\n");
+	buffer_append_long_hex(b, len);
+	BUFFER_APPEND_STRING_CONST(b, "\r\n");
+
+	return 0;
+}
+
+/**
+ * 生成最后的chunk，即"0\r\n\r\n"，不带trailer
+ *
+ * @param b 保存框架的buffer，原有内容被覆盖
+ * @param first 是否没有发送过任何chunk
+ *
+ * @return 成功返回0，否则返回-1
+ */
+int chunked_encode_last_chunk(buffer *b, int first) {
+	if (!b) return -1;
+
+	buffer_reset(b);
+	if (!first) BUFFER_APPEND_STRING_CONST(b, "\r\n");
+	BUFFER_APPEND_STRING_CONST(b, "0\r\n\r\n");
+
+	return 0;
+}
+
+/**
+ * 初始化解码状态
+ *
+ * @param d 解码状态
+ * @param max_body 解码后数据总长度的上限，0表示不限制
+ */
+void chunked_decoder_init(chunked_decoder *d, off_t max_body) {
+	memset(d, 0, sizeof(*d));
+	d->state = CHUNKED_SIZE;
+	d->max_body = max_body;
+}
+
+/**
+ * 就地解码chunked数据
+ *
+ * 从p开始的len个字节中去掉chunk的框架，把数据依次移到p的开头。
+ * 数据可以在任意位置被截断，下次调用从断点继续。
+ * chunk-size行不能超过CHUNKED_MAX_LINE，trailer不能超过
+ * li_tunables.max_http_request_header，trailer的内容被丢弃。
+ * 和请求头一样，单独的'\n'也被当作行尾
+ *
+ * 结束之后的数据(如下一个请求)不会被消耗，从p + *consumed开始
+ *
+ * @param d 解码状态
+ * @param p 收到的数据，可以是buffer或read_buffer中的内存
+ * @param len 数据的长度
+ * @param consumed 返回消耗掉的输入字节数
+ * @param out_len 返回解码出的数据长度，数据位于p的开头
+ *
+ * @return 需要更多数据返回0，全部结束返回1，格式错误或超过限制返回-1
+ */
+int chunked_decode(chunked_decoder *d, char *p, size_t len, size_t *consumed, size_t *out_len) {
+	size_t i = 0, out = 0, n;
+	char c;
+
+	while (i < len && d->state != CHUNKED_DONE) {
+		if (d->state == CHUNKED_DATA) {
+			/* 数据部分整块移动，不逐个字节处理 */
+			n = len - i;
+			if ((off_t)n > d->chunk_left) n = d->chunk_left;
+
+			if (out != i) memmove(p + out, p + i, n);
+			out += n;
+			i += n;
+			d->chunk_left -= n;
+
+			if (d->chunk_left == 0) d->state = CHUNKED_DATA_CR;
+			continue;
+		}
+
+		c = p[i++];
+
+		switch (d->state) {
+		case CHUNKED_SIZE:
+			if (light_isxdigit(c)) {
+				/* 限制位数，保证off_t不会溢出 */
+				if (++d->line_len >= sizeof(off_t) * 2) return -1;
+				d->chunk_left = (d->chunk_left << 4) | hex2int(c);
+				break;
+			}
+			if (d->line_len == 0) return -1;
+
+			if (c == ';' || c == ' ' || c == '\t') {
+				d->state = CHUNKED_SIZE_EXT;
+				break;
+			} else if (c == '\r') {
+				d->state = CHUNKED_SIZE_LF;
+				break;
+			} else if (c != '\n') {
+				return -1;
+			}
+			goto size_done;
+		case CHUNKED_SIZE_EXT:
+			if (++d->line_len > CHUNKED_MAX_LINE) return -1;
+			if (c != '\n') break;
+			goto size_done;
+		case CHUNKED_SIZE_LF:
+			if (c != '\n') return -1;
+		size_done:
+			d->line_len = 0;
+			if (d->chunk_left == 0) {
+				d->state = CHUNKED_TRAILER;
+				break;
+			}
+			if (d->max_body && d->chunk_left > d->max_body - d->body_len) return -1;
+			d->body_len += d->chunk_left;
+			d->state = CHUNKED_DATA;
+			break;
+		case CHUNKED_DATA_CR:
+			if (c == '\r') {
+				d->state = CHUNKED_DATA_LF;
+				break;
+			}
+			/* fall through */
+		case CHUNKED_DATA_LF:
+			if (c != '\n') return -1;
+			d->state = CHUNKED_SIZE;
+			break;
+		case CHUNKED_TRAILER:
+			if (c == '\n') {
+				d->state = CHUNKED_DONE;
+				break;
+			} else if (c == '\r') {
+				d->state = CHUNKED_TRAILER_LF;
+				break;
+			}
+			d->state = CHUNKED_TRAILER_LINE;
+			/* fall through */
+		case CHUNKED_TRAILER_LINE:
+			if (++d->trailer_len > li_tunables.max_http_request_header) return -1;
+			if (c == '\n') d->state = CHUNKED_TRAILER;
+			break;
+		case CHUNKED_TRAILER_LF:
+			if (c != '\n') return -1;
+			d->state = CHUNKED_DONE;
+			break;
+		default:
+			return -1;
+		}
+	}
+
+	*consumed = i;
+	*out_len = out;
+
+	return d->state == CHUNKED_DONE ? 1 : 0;
+}
@@ -0,0 +1,37 @@
+
+/**
+ * chunked传输编码的流式编解码
+ *
+ * 编码时只生成每个chunk前后的小段框架，数据本身不复制；
+ * 解码时在原内存上就地去掉框架，状态保存在chunked_decoder中，
+ * 数据可以分多次到达
+ */
+
+#ifndef _CHUNKED_H_
+#define _CHUNKED_H_
+
+#include "buffer.h"
+
+/**
+ * chunk-size行(包括扩展)的最大长度
+ */
+#define CHUNKED_MAX_LINE 1024
+
+typedef struct {
+	int state;
+
+	off_t chunk_left;   /* 当前chunk还剩多少数据 */
+	off_t body_len;     /* 已经解码出的数据总长度 */
+	off_t max_body;     /* 数据总长度的上限，0表示不限制 */
+
+	size_t line_len;    /* 当前chunk-size行已读的长度 */
+	size_t trailer_len; /* trailer已读的长度 */
+} chunked_decoder;
+
+int chunked_encode_chunk_header(buffer *b, size_t len, int first);
+int chunked_encode_last_chunk(buffer *b, int first);
+
+void chunked_decoder_init(chunked_decoder *d, off_t max_body);
+int chunked_decode(chunked_decoder *d, char *p, size_t len, size_t *consumed, size_t *out_len);
+
+#endif
@@ -0,0 +1,113 @@
+
+/**
+ * 基于handler_t的无栈协程
+ *
+ * 模块的处理函数原来是手写的状态机，返回HANDLER_WAIT_FOR_EVENT
+ * 或HANDLER_COMEBACK之后，再次进入时要根据各种标志判断做到哪里了。
+ * 用这里的宏可以在挂起的地方直接继续，只需要在状态中保存一个int，
+ * 没有任何内存分配
+ *
+ * 例如:
+ *
+ *	typedef struct {
+ *		cont c;
+ *		... 其它需要跨越挂起点的变量 ...
+ *	} handler_ctx;
+ *
+ *	static handler_t mod_foo_handle(server *srv, connection *con, handler_ctx *hctx) {
+ *		CONT_BEGIN(&hctx->c);
+ *
+ *		... 发出请求 ...
+ *		CONT_WAIT_UNTIL(&hctx->c, response_ready(hctx), HANDLER_WAIT_FOR_EVENT);
+ *
+ *		while (has_more(hctx)) {
+ *			... 处理一部分 ...
+ *			CONT_YIELD(&hctx->c, HANDLER_COMEBACK);
+ *		}
+ *
+ *		CONT_AWAIT(&hctx->c, mod_foo_send(srv, con, hctx));
+ *
+ *		CONT_END(&hctx->c);
+ *	}
+ *
+ * 限制:
+ *  - 局部变量在挂起之后不再有效，要保存的值放在状态中
+ *  - CONT_BEGIN和CONT_END之间不能再用switch
+ *  - 一行只能有一个挂起点，因为用__LINE__区分挂起点
+ */
+
+#ifndef _CONTINUATION_H_
+#define _CONTINUATION_H_
+
+#include "settings.h"
+
+/**
+ * 协程的状态，即上次挂起的位置，0表示从头开始
+ */
+typedef struct {
+	int line;
+} cont;
+
+/**
+ * 挂起点的case标签是从上一句直接落下来的，告诉编译器这是故意的
+ */
+#if defined(__GNUC__) && __GNUC__ >= 7
+# define CONT_FALLTHROUGH __attribute__ ((fallthrough))
+#else
+# define CONT_FALLTHROUGH ((void)0)
+#endif
+
+#define CONT_INIT(c) ((c)->line = 0)
+#define CONT_IS_RUNNING(c) ((c)->line != 0)
+
+#define CONT_BEGIN(c) switch ((c)->line) { case 0:
+
+/**
+ * 结束，下次从头开始，返回HANDLER_FINISHED
+ */
+#define CONT_END(c) } (c)->line = 0; return HANDLER_FINISHED
+
+/**
+ * 提前结束，下次从头开始
+ *
+ * @param r 返回值，如HANDLER_ERROR或HANDLER_GO_ON
+ */
+#define CONT_EXIT(c, r) \
+	do { (c)->line = 0; return (r); } while (0)
+
+/**
+ * 挂起并返回r，下次从这里继续
+ *
+ * @param r 一般为HANDLER_WAIT_FOR_EVENT、HANDLER_COMEBACK或HANDLER_WAIT_FOR_FD
+ */
+#define CONT_YIELD(c, r) \
+	do { (c)->line = __LINE__; return (r); case __LINE__:; } while (0)
+
+#define CONT_WAIT_FOR_EVENT(c) CONT_YIELD(c, HANDLER_WAIT_FOR_EVENT)
+#define CONT_COMEBACK(c)       CONT_YIELD(c, HANDLER_COMEBACK)
+
+/**
+ * 条件不成立时挂起并返回r，下次进入时重新检查条件
+ */
+#define CONT_WAIT_UNTIL(c, cond, r) \
+	do { (c)->line = __LINE__; CONT_FALLTHROUGH; case __LINE__: if (!(cond)) return (r); } while (0)
+
+/**
+ * 调用另一个返回handler_t的函数(一般也是协程)，直到它完成
+ *
+ * 它返回HANDLER_WAIT_FOR_EVENT、HANDLER_COMEBACK或HANDLER_WAIT_FOR_FD时
+ * 原样返回，下次进入时再次调用它；返回HANDLER_ERROR时结束
+ * 并返回HANDLER_ERROR；其它返回值表示它完成了，继续往下执行
+ */
+#define CONT_AWAIT(c, call) \
+	do { \
+		handler_t cont_r_; \
+		(c)->line = __LINE__; CONT_FALLTHROUGH; case __LINE__: \
+		cont_r_ = (call); \
+		if (cont_r_ == HANDLER_WAIT_FOR_EVENT || \
+		    cont_r_ == HANDLER_COMEBACK || \
+		    cont_r_ == HANDLER_WAIT_FOR_FD) return cont_r_; \
+		if (cont_r_ == HANDLER_ERROR) CONT_EXIT(c, HANDLER_ERROR); \
+	} while (0)
+
+#endif
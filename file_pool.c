@@ -0,0 +1,471 @@
+
+/**
+ * 记住一条:任务只在事件循环的线程中提交和取回，
+ * 工作线程只碰任务本身、队列和完成链表
+ *
+ * 典型的用法:
+ *
+ *	if (!hctx->job.pending && hctx->job.type == FILE_JOB_UNSET) {
+ *		return file_pool_submit(srv->file_pool, &hctx->job, FILE_JOB_OPEN, con->physical.path, con);
+ *	}
+ *	if (hctx->job.pending) return HANDLER_WAIT_FOR_EVENT;
+ *	switch (file_job_result(&hctx->job)) { ... }
+ *
+ *	file_pool_get_fd的fd可读时:
+ *		n = file_pool_reap(srv->file_pool, done, 64);
+ *		... 对done[i]->ctx对应的连接重新调用处理函数 ...
+ */
+
+#include "file_pool.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef __linux__
+# include <sys/eventfd.h>
+#endif
+
+/**
+ * 一个工作线程的任务队列
+ */
+typedef struct {
+	pthread_mutex_t lock;
+	file_job *jobs[FILE_POOL_QUEUE_SIZE];
+	size_t head;            /* 下一个要取的位置，自己从这里取 */
+	size_t tail;            /* 下一个要放的位置，别的线程从tail - 1偷 */
+
+	pthread_t thread;
+	struct file_pool *pool;
+	unsigned int ndx;
+} file_pool_worker;
+
+struct file_pool {
+	file_pool_worker *workers;
+	unsigned int nworkers;
+	unsigned int next;      /* 下一次提交到哪个线程 */
+
+	pthread_mutex_t sleep_lock;
+	pthread_cond_t sleep_cond;
+	size_t queued;          /* 所有队列中的任务数，受sleep_lock保护 */
+	int shutdown;
+
+	pthread_mutex_t done_lock;
+	file_job *done_head;    /* 完成链表，受done_lock保护 */
+	file_job *done_tail;
+	file_pool_stats stats;  /* 受done_lock保护 */
+
+	int notify_fd[2];       /* eventfd时两个相同 */
+};
+
+static uint64_t file_pool_now(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/**
+ * 从线程自己的队列头部取
+ */
+static file_job *file_pool_pop(file_pool_worker *w) {
+	file_job *job = NULL;
+
+	pthread_mutex_lock(&w->lock);
+	if (w->head != w->tail) {
+		job = w->jobs[w->head & (FILE_POOL_QUEUE_SIZE - 1)];
+		w->head++;
+	}
+	pthread_mutex_unlock(&w->lock);
+
+	return job;
+}
+
+/**
+ * 从别的线程的队列尾部偷
+ */
+static file_job *file_pool_steal(file_pool_worker *w) {
+	file_job *job = NULL;
+
+	pthread_mutex_lock(&w->lock);
+	if (w->head != w->tail) {
+		w->tail--;
+		job = w->jobs[w->tail & (FILE_POOL_QUEUE_SIZE - 1)];
+	}
+	pthread_mutex_unlock(&w->lock);
+
+	return job;
+}
+
+/**
+ * 执行一个任务
+ */
+static void file_pool_run(file_job *job) {
+	int fd;
+
+	job->err = 0;
+	job->fd = -1;
+
+	switch (job->type) {
+	case FILE_JOB_STAT:
+		if (-1 == stat(job->name->ptr, &job->st)) job->err = errno;
+		break;
+	case FILE_JOB_OPEN:
+		if (-1 == (fd = open(job->name->ptr, O_RDONLY | O_NOCTTY))) {
+			job->err = errno;
+			break;
+		}
+		fcntl(fd, F_SETFD, FD_CLOEXEC);
+		if (-1 == fstat(fd, &job->st)) {
+			job->err = errno;
+			close(fd);
+			break;
+		}
+		job->fd = fd;
+		break;
+	default:
+		job->err = EINVAL;
+		break;
+	}
+}
+
+/**
+ * 把完成的任务放进完成链表，并通知事件循环
+ */
+static void file_pool_complete(file_pool *p, file_job *job, int stolen) {
+	uint64_t one = 1, latency;
+	int was_empty;
+
+	job->done_usec = file_pool_now();
+	latency = job->done_usec - job->submit_usec;
+
+	pthread_mutex_lock(&p->done_lock);
+	job->next = NULL;
+	was_empty = (p->done_head == NULL);
+	if (p->done_tail) {
+		p->done_tail->next = job;
+	} else {
+		p->done_head = job;
+	}
+	p->done_tail = job;
+
+	p->stats.completed++;
+	if (stolen) p->stats.stolen++;
+	p->stats.depth--;
+	p->stats.wait_usec += job->start_usec - job->submit_usec;
+	p->stats.run_usec += job->done_usec - job->start_usec;
+	if (latency > p->stats.max_latency_usec) p->stats.max_latency_usec = latency;
+	pthread_mutex_unlock(&p->done_lock);
+
+	/* 链表原来不空时事件循环已经被通知过了 */
+	if (was_empty) {
+		while (-1 == write(p->notify_fd[1], &one, p->notify_fd[0] == p->notify_fd[1] ? sizeof(one) : 1) && errno == EINTR);
+	}
+}
+
+static void *file_pool_worker_main(void *arg) {
+	file_pool_worker *w = arg;
+	file_pool *p = w->pool;
+	file_job *job;
+	unsigned int i;
+	int stolen;
+
+	for (;;) {
+		stolen = 0;
+		job = file_pool_pop(w);
+
+		for (i = 1; job == NULL && i < p->nworkers; i++) {
+			job = file_pool_steal(&p->workers[(w->ndx + i) % p->nworkers]);
+			stolen = 1;
+		}
+
+		pthread_mutex_lock(&p->sleep_lock);
+		if (job) {
+			p->queued--;
+		} else {
+			while (p->queued == 0 && !p->shutdown) {
+				pthread_cond_wait(&p->sleep_cond, &p->sleep_lock);
+			}
+			if (p->queued == 0 && p->shutdown) {
+				pthread_mutex_unlock(&p->sleep_lock);
+				break;
+			}
+		}
+		pthread_mutex_unlock(&p->sleep_lock);
+
+		if (job == NULL) continue;
+
+		job->start_usec = file_pool_now();
+		file_pool_run(job);
+		file_pool_complete(p, job, stolen);
+	}
+
+	return NULL;
+}
+
+/**
+ * 停止线程并释放线程池
+ *
+ * 启动了的线程会偷所有线程的队列，所以先等它们退出，
+ * 再销毁全部nworkers个队列的锁，包括没有启动的线程的
+ *
+ * @param started 已经启动的线程数
+ */
+static void file_pool_destroy(file_pool *p, unsigned int started) {
+	file_job *job;
+	unsigned int i;
+
+	pthread_mutex_lock(&p->sleep_lock);
+	p->shutdown = 1;
+	pthread_cond_broadcast(&p->sleep_cond);
+	pthread_mutex_unlock(&p->sleep_lock);
+
+	for (i = 0; i < started; i++) {
+		pthread_join(p->workers[i].thread, NULL);
+	}
+	for (i = 0; i < p->nworkers; i++) {
+		pthread_mutex_destroy(&p->workers[i].lock);
+	}
+
+	for (job = p->done_head; job; job = job->next) {
+		if (job->fd != -1) close(job->fd);
+		job->fd = -1;
+		job->pending = 0;
+	}
+
+	close(p->notify_fd[0]);
+	if (p->notify_fd[1] != p->notify_fd[0]) close(p->notify_fd[1]);
+
+	pthread_mutex_destroy(&p->sleep_lock);
+	pthread_cond_destroy(&p->sleep_cond);
+	pthread_mutex_destroy(&p->done_lock);
+
+	free(p->workers);
+	free(p);
+}
+
+/**
+ * 建立线程池
+ *
+ * @param nthreads 工作线程数，0时取4
+ *
+ * @return 成功返回线程池，失败返回NULL，调用者应直接调用stat/open
+ */
+file_pool *file_pool_init(unsigned int nthreads) {
+	file_pool *p;
+	unsigned int i;
+
+	if (nthreads == 0) nthreads = 4;
+
+	p = calloc(1, sizeof(*p));
+	assert(p);
+
+#ifdef __linux__
+	p->notify_fd[0] = p->notify_fd[1] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (p->notify_fd[0] == -1) {
+		free(p);
+		return NULL;
+	}
+#else
+	if (-1 == pipe(p->notify_fd)) {
+		free(p);
+		return NULL;
+	}
+	for (i = 0; i < 2; i++) {
+		fcntl(p->notify_fd[i], F_SETFL, fcntl(p->notify_fd[i], F_GETFL) | O_NONBLOCK);
+		fcntl(p->notify_fd[i], F_SETFD, FD_CLOEXEC);
+	}
+#endif
+
+	pthread_mutex_init(&p->sleep_lock, NULL);
+	pthread_cond_init(&p->sleep_cond, NULL);
+	pthread_mutex_init(&p->done_lock, NULL);
+
+	p->workers = calloc(nthreads, sizeof(*p->workers));
+	assert(p->workers);
+
+	for (i = 0; i < nthreads; i++) {
+		file_pool_worker *w = &p->workers[i];
+
+		pthread_mutex_init(&w->lock, NULL);
+		w->pool = p;
+		w->ndx = i;
+	}
+
+	/* 全部初始化之后再启动，线程偷任务时会访问别的线程的队列 */
+	p->nworkers = nthreads;
+	for (i = 0; i < nthreads; i++) {
+		if (0 != pthread_create(&p->workers[i].thread, NULL, file_pool_worker_main, &p->workers[i])) {
+			file_pool_destroy(p, i);
+			return NULL;
+		}
+	}
+
+	return p;
+}
+
+/**
+ * 停止所有线程并释放线程池
+ *
+ * 已经提交的任务会执行完，但没有取回的结果被丢弃，
+ * 其中打开的fd也被关闭
+ */
+void file_pool_free(file_pool *p) {
+	if (!p) return;
+
+	file_pool_destroy(p, p->nworkers);
+}
+
+/**
+ * 提交一个任务
+ *
+ * @param p 线程池
+ * @param job 任务
+ * @param type FILE_JOB_STAT或FILE_JOB_OPEN
+ * @param name 路径，完成之前不能修改
+ * @param ctx 调用者的数据
+ *
+ * @return 提交成功返回HANDLER_WAIT_FOR_EVENT，连接应挂起等待完成；
+ *         队列满返回HANDLER_COMEBACK，下一轮再试；
+ *         参数错误返回HANDLER_ERROR
+ */
+handler_t file_pool_submit(file_pool *p, file_job *job, file_job_t type, buffer *name, void *ctx) {
+	file_pool_worker *w;
+	unsigned int i;
+
+	if (!p || !job || job->pending || buffer_is_empty(name)) return HANDLER_ERROR;
+
+	job->type = type;
+	job->name = name;
+	job->ctx = ctx;
+	job->fd = -1;
+	job->err = 0;
+	job->next = NULL;
+	job->submit_usec = file_pool_now();
+
+	/* 先计入，放入队列之后工作线程随时可能完成它 */
+	pthread_mutex_lock(&p->done_lock);
+	p->stats.submitted++;
+	if (++p->stats.depth > p->stats.max_depth) p->stats.max_depth = p->stats.depth;
+	pthread_mutex_unlock(&p->done_lock);
+
+	/* queued也要先加上，否则工作线程取走任务时queued可能还是0，减成负数 */
+	pthread_mutex_lock(&p->sleep_lock);
+	p->queued++;
+	pthread_mutex_unlock(&p->sleep_lock);
+
+	/* 轮流放入，当前线程的队列满了就试下一个 */
+	for (i = 0; i < p->nworkers; i++) {
+		w = &p->workers[p->next];
+		p->next = (p->next + 1) % p->nworkers;
+
+		pthread_mutex_lock(&w->lock);
+		if (w->tail - w->head < FILE_POOL_QUEUE_SIZE) {
+			w->jobs[w->tail & (FILE_POOL_QUEUE_SIZE - 1)] = job;
+			w->tail++;
+			job->pending = 1;
+		}
+		pthread_mutex_unlock(&w->lock);
+
+		if (job->pending) break;
+	}
+
+	if (!job->pending) {
+		pthread_mutex_lock(&p->sleep_lock);
+		p->queued--;
+		pthread_mutex_unlock(&p->sleep_lock);
+
+		pthread_mutex_lock(&p->done_lock);
+		p->stats.submitted--;
+		p->stats.depth--;
+		p->stats.rejected++;
+		pthread_mutex_unlock(&p->done_lock);
+
+		return HANDLER_COMEBACK;
+	}
+
+	pthread_mutex_lock(&p->sleep_lock);
+	pthread_cond_signal(&p->sleep_cond);
+	pthread_mutex_unlock(&p->sleep_lock);
+
+	return HANDLER_WAIT_FOR_EVENT;
+}
+
+/**
+ * 把完成的任务的结果转换为handler_t
+ *
+ * @return 成功返回HANDLER_GO_ON；打开时fd用完(EMFILE/ENFILE)返回
+ *         HANDLER_WAIT_FOR_FD；其它错误返回HANDLER_ERROR，原因见job->err；
+ *         还没有完成返回HANDLER_WAIT_FOR_EVENT
+ */
+handler_t file_job_result(file_job *job) {
+	if (job->pending) return HANDLER_WAIT_FOR_EVENT;
+	if (job->err == 0) return HANDLER_GO_ON;
+	if (job->err == EMFILE || job->err == ENFILE) return HANDLER_WAIT_FOR_FD;
+
+	return HANDLER_ERROR;
+}
+
+/**
+ * 完成通知的fd，调用者把它加到事件循环中，可读时调用file_pool_reap
+ */
+int file_pool_get_fd(file_pool *p) {
+	return p ? p->notify_fd[0] : -1;
+}
+
+/**
+ * 取回完成的任务，不等待
+ *
+ * 一次没有取完时通知仍然有效，下一轮会再次可读
+ *
+ * @param done 保存完成的任务
+ * @param max done的大小
+ *
+ * @return 取回的个数
+ */
+size_t file_pool_reap(file_pool *p, file_job **done, size_t max) {
+	char buf[64];
+	file_job *job;
+	size_t n = 0;
+
+	if (!p || max == 0) return 0;
+
+	/* 先清除通知再取，之后完成的任务会重新通知 */
+	while (read(p->notify_fd[0], buf, sizeof(buf)) > 0) {
+		if (p->notify_fd[0] == p->notify_fd[1]) break;
+	}
+
+	pthread_mutex_lock(&p->done_lock);
+	while (n < max && NULL != (job = p->done_head)) {
+		p->done_head = job->next;
+		if (p->done_head == NULL) p->done_tail = NULL;
+
+		job->next = NULL;
+		job->pending = 0;
+		done[n++] = job;
+	}
+
+	/* 没有取完，重新通知自己 */
+	if (p->done_head) {
+		uint64_t one = 1;
+		while (-1 == write(p->notify_fd[1], &one, p->notify_fd[0] == p->notify_fd[1] ? sizeof(one) : 1) && errno == EINTR);
+	}
+	pthread_mutex_unlock(&p->done_lock);
+
+	return n;
+}
+
+/**
+ * 读取统计
+ */
+void file_pool_get_stats(file_pool *p, file_pool_stats *st) {
+	pthread_mutex_lock(&p->done_lock);
+	*st = p->stats;
+	pthread_mutex_unlock(&p->done_lock);
+}
@@ -0,0 +1,80 @@
+
+/**
+ * 在线程池中执行会阻塞的stat/open
+ *
+ * 缓存冷的时候或在网络文件系统上，stat和open可能阻塞很久，
+ * 整个事件循环和所有连接都会被卡住。这里把它们交给工作线程，
+ * 完成后通过一个fd通知事件循环，等待的连接在此期间
+ * 返回HANDLER_WAIT_FOR_EVENT挂起
+ *
+ * 每个工作线程有自己的队列，提交时轮流放入，线程自己的队列
+ * 空了就从别的线程的队列尾部偷任务
+ */
+
+#ifndef _FILE_POOL_H_
+#define _FILE_POOL_H_
+
+#include "buffer.h"
+#include "settings.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <stdint.h>
+
+#define FILE_POOL_QUEUE_SIZE 1024 /* 每个线程队列的大小，必须是2的幂 */
+
+typedef enum {
+	FILE_JOB_UNSET,
+	FILE_JOB_STAT,
+	FILE_JOB_OPEN
+} file_job_t;
+
+/**
+ * 一个任务，一般嵌在connection或handler_ctx中
+ *
+ * 从提交到被file_pool_reap取回之前，job和name都不能修改或释放
+ */
+typedef struct file_job {
+	file_job_t type;
+	buffer *name;           /* 路径 */
+
+	struct stat st;         /* 结果 */
+	int fd;                 /* FILE_JOB_OPEN打开的fd，失败为-1 */
+	int err;                /* 失败时的errno，成功为0 */
+
+	uint64_t submit_usec;
+	uint64_t start_usec;
+	uint64_t done_usec;
+
+	int pending;
+	void *ctx;              /* 调用者的数据，一般为connection */
+	struct file_job *next;
+} file_job;
+
+typedef struct {
+	uint64_t submitted;
+	uint64_t completed;
+	uint64_t stolen;        /* 从别的线程偷来执行的任务数 */
+	uint64_t rejected;      /* 队列满被拒绝的次数 */
+
+	size_t depth;           /* 提交了还没有完成的任务数 */
+	size_t max_depth;
+
+	uint64_t wait_usec;     /* 在队列中等待的总时间 */
+	uint64_t run_usec;      /* 执行的总时间 */
+	uint64_t max_latency_usec; /* 从提交到完成的最长时间 */
+} file_pool_stats;
+
+typedef struct file_pool file_pool;
+
+file_pool *file_pool_init(unsigned int nthreads);
+void file_pool_free(file_pool *p);
+
+handler_t file_pool_submit(file_pool *p, file_job *job, file_job_t type, buffer *name, void *ctx);
+handler_t file_job_result(file_job *job);
+
+int file_pool_get_fd(file_pool *p);
+size_t file_pool_reap(file_pool *p, file_job **done, size_t max);
+void file_pool_get_stats(file_pool *p, file_pool_stats *st);
+
+#endif
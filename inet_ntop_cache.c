@@ -0,0 +1,246 @@
+/**
+ * 客户端地址到字符串的缓存
+ *
+ * 每条日志和每个CGI环境变量都要把客户端地址格式化一次，
+ * 原来只有INET_NTOP_CACHE_MAX(4)项，几乎不会命中。
+ * 这里改为按地址散列的组相联缓存，IPv4和IPv6都支持。
+ *
+ * 每个槽用一个序号(seqlock)保护:写的时候序号为奇数，
+ * 写完加到下一个偶数。读者不加锁，读之前和之后序号相同
+ * 且为偶数，就说明读到的是完整的内容。写者之间用CAS抢
+ * 序号，抢不到的就放弃缓存，反正结果已经格式化好了。
+ * 因为要在不加锁的情况下复制，字符串直接存在槽里，
+ * 而不是存一个buffer指针。
+ *
+ * 读者和写者可能同时访问槽的内容，所以内容按字存成原子变量，
+ * 两边都用relaxed的原子读写逐字复制，序号负责判断读到的是否
+ * 完整。直接memcpy在C11中是数据竞争，ThreadSanitizer也会报告
+ */
+
+#include "inet_ntop_cache.h"
+
+#include <string.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#if defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L && !defined(__STDC_NO_ATOMICS__)
+# define INET_NTOP_CACHE_ATOMIC 1
+# include <stdatomic.h>
+#endif
+
+#define INET_NTOP_CACHE_BUCKETS (INET_NTOP_CACHE_MAX / INET_NTOP_CACHE_WAYS)
+
+/**
+ * 地址的比较键，IPv4地址放在前4个字节
+ */
+typedef struct {
+	int family;
+	unsigned char addr[16];
+} inet_ntop_key;
+
+/**
+ * 把sockaddr转换成比较键和inet_ntop所需的参数
+ *
+ * @return 成功返回0，不支持的地址族返回-1
+ */
+static int inet_ntop_cache_key(const struct sockaddr *sa, inet_ntop_key *key, const void **src) {
+	memset(key, 0, sizeof(*key));
+	key->family = sa->sa_family;
+
+	switch (sa->sa_family) {
+	case AF_INET:
+		*src = &((const struct sockaddr_in *)sa)->sin_addr;
+		memcpy(key->addr, *src, 4);
+		return 0;
+#ifdef AF_INET6
+	case AF_INET6:
+		*src = &((const struct sockaddr_in6 *)sa)->sin6_addr;
+		memcpy(key->addr, *src, 16);
+		return 0;
+#endif
+	default:
+		return -1;
+	}
+}
+
+#ifdef INET_NTOP_CACHE_ATOMIC
+
+/**
+ * 槽中保存的内容
+ */
+typedef struct {
+	inet_ntop_key key;
+	unsigned char len;
+	char str[INET6_ADDRSTRLEN];
+} inet_ntop_entry;
+
+#define INET_NTOP_ENTRY_WORDS ((sizeof(inet_ntop_entry) + sizeof(uint64_t) - 1) / sizeof(uint64_t))
+
+/**
+ * inet_ntop_entry按字复制用的缓冲
+ */
+typedef union {
+	inet_ntop_entry e;
+	uint64_t w[INET_NTOP_ENTRY_WORDS];
+} inet_ntop_words;
+
+typedef struct {
+	_Atomic unsigned int seq;  /* 偶数表示内容稳定，奇数表示正在写；0表示空 */
+	_Atomic unsigned char ref; /* CLOCK的引用位，命中时置1 */
+
+	_Atomic uint64_t data[INET_NTOP_ENTRY_WORDS]; /* inet_ntop_entry */
+} inet_ntop_slot;
+
+typedef struct {
+	inet_ntop_slot slots[INET_NTOP_CACHE_WAYS];
+	_Atomic unsigned int hand; /* CLOCK的指针 */
+} inet_ntop_bucket;
+
+static inet_ntop_bucket inet_ntop_cache[INET_NTOP_CACHE_BUCKETS];
+static _Atomic uint64_t inet_ntop_cache_hits;
+static _Atomic uint64_t inet_ntop_cache_misses;
+
+/**
+ * 在桶中不加锁地查找
+ *
+ * @return 命中时把字符串复制到str并返回长度，否则返回0
+ */
+static size_t inet_ntop_cache_lookup(inet_ntop_bucket *bkt, const inet_ntop_key *key, char *str) {
+	inet_ntop_slot *s;
+	inet_ntop_words copy;
+	unsigned int seq;
+	size_t i, j;
+
+	for (i = 0; i < INET_NTOP_CACHE_WAYS; i++) {
+		s = bkt->slots + i;
+
+		seq = atomic_load_explicit(&s->seq, memory_order_acquire);
+		if (seq == 0 || (seq & 1)) continue;
+
+		for (j = 0; j < INET_NTOP_ENTRY_WORDS; j++) {
+			copy.w[j] = atomic_load_explicit(&s->data[j], memory_order_relaxed);
+		}
+
+		/* 序号没变才说明读到的内容是完整的 */
+		atomic_thread_fence(memory_order_acquire);
+		if (seq != atomic_load_explicit(&s->seq, memory_order_relaxed)) continue;
+
+		if (0 == memcmp(&copy.e.key, key, sizeof(*key)) && copy.e.len < sizeof(copy.e.str)) {
+			memcpy(str, copy.e.str, copy.e.len + 1);
+			atomic_store_explicit(&s->ref, 1, memory_order_relaxed);
+			return copy.e.len;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * 按CLOCK算法选一个槽写入新的内容
+ *
+ * 指针扫过的槽如果引用位为1就清零并跳过，给它第二次机会；
+ * 为0就淘汰。最多扫两圈，和别的写者冲突时直接放弃
+ */
+static void inet_ntop_cache_insert(inet_ntop_bucket *bkt, const inet_ntop_key *key, const char *str, size_t len) {
+	inet_ntop_slot *s;
+	inet_ntop_words copy;
+	unsigned int seq;
+	size_t i, j;
+
+	memset(&copy, 0, sizeof(copy));
+	copy.e.key = *key;
+	copy.e.len = len;
+	memcpy(copy.e.str, str, len + 1);
+
+	for (i = 0; i < 2 * INET_NTOP_CACHE_WAYS; i++) {
+		s = bkt->slots + atomic_fetch_add_explicit(&bkt->hand, 1, memory_order_relaxed) % INET_NTOP_CACHE_WAYS;
+
+		if (atomic_exchange_explicit(&s->ref, 0, memory_order_relaxed)) continue;
+
+		seq = atomic_load_explicit(&s->seq, memory_order_relaxed);
+		if (seq & 1) return;
+		if (!atomic_compare_exchange_strong_explicit(&s->seq, &seq, seq + 1,
+				memory_order_acquire, memory_order_relaxed)) {
+			return;
+		}
+		atomic_thread_fence(memory_order_release);
+
+		for (j = 0; j < INET_NTOP_ENTRY_WORDS; j++) {
+			atomic_store_explicit(&s->data[j], copy.w[j], memory_order_relaxed);
+		}
+
+		atomic_store_explicit(&s->seq, seq + 2, memory_order_release);
+		return;
+	}
+}
+
+/**
+ * 把客户端地址格式化后追加到buffer对象上
+ *
+ * 先不加锁地查缓存，没有命中再调用inet_ntop并写入缓存。
+ * 可以被多个线程同时调用
+ *
+ * @param b 要追加到的buffer对象
+ * @param sa 客户端地址
+ *
+ * @return 成功返回0，不支持的地址族返回-1
+ */
+int inet_ntop_cache_append(buffer *b, const struct sockaddr *sa) {
+	inet_ntop_bucket *bkt;
+	inet_ntop_key key;
+	const void *src;
+	char str[INET6_ADDRSTRLEN];
+	size_t len;
+
+	if (!b || !sa) return -1;
+	if (0 != inet_ntop_cache_key(sa, &key, &src)) return -1;
+
+	bkt = inet_ntop_cache + buffer_hash_len((const char *)&key, sizeof(key)) % INET_NTOP_CACHE_BUCKETS;
+
+	if (0 != (len = inet_ntop_cache_lookup(bkt, &key, str))) {
+		atomic_fetch_add_explicit(&inet_ntop_cache_hits, 1, memory_order_relaxed);
+		return buffer_append_string_len(b, str, len);
+	}
+
+	atomic_fetch_add_explicit(&inet_ntop_cache_misses, 1, memory_order_relaxed);
+
+	if (NULL == inet_ntop(key.family, src, str, sizeof(str))) return -1;
+	len = strlen(str);
+
+	inet_ntop_cache_insert(bkt, &key, str, len);
+
+	return buffer_append_string_len(b, str, len);
+}
+
+/**
+ * 取命中和未命中的次数，用于计算命中率
+ */
+void inet_ntop_cache_stats(uint64_t *hits, uint64_t *misses) {
+	if (hits) *hits = atomic_load_explicit(&inet_ntop_cache_hits, memory_order_relaxed);
+	if (misses) *misses = atomic_load_explicit(&inet_ntop_cache_misses, memory_order_relaxed);
+}
+
+#else
+
+/**
+ * 没有C11原子操作时不做缓存，每次都格式化
+ */
+int inet_ntop_cache_append(buffer *b, const struct sockaddr *sa) {
+	inet_ntop_key key;
+	const void *src;
+	char str[INET6_ADDRSTRLEN];
+
+	if (!b || !sa) return -1;
+	if (0 != inet_ntop_cache_key(sa, &key, &src)) return -1;
+
+	if (NULL == inet_ntop(key.family, src, str, sizeof(str))) return -1;
+
+	return buffer_append_string(b, str);
+}
+
+void inet_ntop_cache_stats(uint64_t *hits, uint64_t *misses) {
+	if (hits) *hits = 0;
+	if (misses) *misses = 0;
+}
+
+#endif
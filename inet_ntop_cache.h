@@ -0,0 +1,16 @@
+#ifndef _INET_NTOP_CACHE_H_
+#define _INET_NTOP_CACHE_H_
+
+#include "buffer.h"
+
+#include <sys/socket.h>
+
+/**
+ * 每个散列桶中的槽数，桶内按CLOCK算法淘汰
+ */
+#define INET_NTOP_CACHE_WAYS 4
+
+int inet_ntop_cache_append(buffer *b, const struct sockaddr *sa);
+void inet_ntop_cache_stats(uint64_t *hits, uint64_t *misses);
+
+#endif
@@ -0,0 +1,221 @@
+
+/**
+ * 记住一条:额度只在连接一直有数据可传时才累积，
+ * 连接空闲(HANDLER_WAIT_FOR_EVENT)后额度清零，这是DRR的要点
+ *
+ * 典型的用法，每次事件循环调度一轮，io_sched_next返回NULL时这一轮结束:
+ *
+ *	while (NULL != (c = io_sched_next(s))) {
+ *		len = io_sched_budget(c, li_tunables.max_write_limit);
+ *		... 最多写len个字节，写了n个 ...
+ *		r = io_sched_charge(s, c, n, 1);
+ *		... 数据写完返回HANDLER_WAIT_FOR_EVENT，否则为r ...
+ *		io_sched_done(s, c, r);
+ *	}
+ */
+
+#include "io_sched.h"
+
+#include <string.h>
+#include <time.h>
+
+/**
+ * 取单调时钟，单位为微秒
+ */
+static uint64_t io_sched_now(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/**
+ * 初始化调度器
+ *
+ * @param s 调度器
+ * @param quantum 每轮给每个连接增加的额度，0时取li_tunables.max_write_limit的1/4，
+ *                随运行时的调整变化
+ * @param time_budget_usec 每次调度的时间上限，0表示不限制
+ */
+void io_sched_init(io_sched *s, size_t quantum, uint64_t time_budget_usec) {
+	memset(s, 0, sizeof(*s));
+
+	s->quantum = quantum;
+	s->time_budget_usec = time_budget_usec;
+}
+
+/**
+ * 初始化一个连接的调度状态
+ *
+ * @param c 连接的调度状态，一般嵌在connection中
+ * @param ctx 调用者的数据
+ */
+void io_sched_conn_init(io_sched_conn *c, void *ctx) {
+	memset(c, 0, sizeof(*c));
+	c->ctx = ctx;
+}
+
+/**
+ * 连接就绪，放到队尾
+ *
+ * 已经在队列中的连接不会被重复加入。新加入的连接总是排在
+ * 下一轮:正在一轮之中时本轮已经定下，不在一轮之中时
+ * 下一次io_sched_next开始的就是下一轮
+ */
+void io_sched_enqueue(io_sched *s, io_sched_conn *c) {
+	if (c->queued) return;
+
+	c->queued = 1;
+	c->round = s->round + 1;
+	c->next = NULL;
+	c->enqueue_usec = io_sched_now();
+
+	if (s->tail) {
+		s->tail->next = c;
+	} else {
+		s->head = c;
+	}
+	s->tail = c;
+	s->used++;
+}
+
+/**
+ * 把连接从队列中去掉，连接关闭时调用
+ *
+ * 需要从头查找，不过关闭连接远比调度少见
+ */
+void io_sched_remove(io_sched *s, io_sched_conn *c) {
+	io_sched_conn *p, *prev = NULL;
+
+	if (!c->queued) return;
+
+	for (p = s->head; p; prev = p, p = p->next) {
+		if (p != c) continue;
+
+		if (prev) {
+			prev->next = c->next;
+		} else {
+			s->head = c->next;
+		}
+		if (s->tail == c) s->tail = prev;
+		s->used--;
+		/* 只有本轮还没轮到的连接才计在round_left中 */
+		if (s->round_active && c->round == s->round && s->round_left > 0) s->round_left--;
+		break;
+	}
+
+	c->queued = 0;
+	c->next = NULL;
+	c->deficit = 0;
+}
+
+/**
+ * 取出队首的连接，并给它增加一轮的额度
+ *
+ * 一轮开始时记下队列中的连接数，调度完这么多个连接就结束这一轮，
+ * 返回一次NULL，之后再调用开始新的一轮。本轮中放回队尾或新加入的
+ * 连接排在下一轮，一直返回HANDLER_COMEBACK的连接也不会卡住事件循环
+ *
+ * @return 队首的连接，队列为空或本轮结束时返回NULL
+ */
+io_sched_conn *io_sched_next(io_sched *s) {
+	io_sched_conn *c = s->head;
+	uint64_t wait;
+
+	if (s->round_left == 0) {
+		if (s->round_active) {
+			s->round_active = 0;
+			return NULL;
+		}
+		if (c == NULL) return NULL;
+
+		s->round_left = s->used;
+		s->round_active = 1;
+		s->round++;
+	}
+
+	if (c == NULL) {
+		s->round_left = 0;
+		s->round_active = 0;
+		return NULL;
+	}
+	s->round_left--;
+
+	s->head = c->next;
+	if (s->head == NULL) s->tail = NULL;
+	s->used--;
+
+	c->queued = 0;
+	c->next = NULL;
+	c->deficit += s->quantum ? s->quantum : li_tunables.max_write_limit / 4;
+	c->passes++;
+
+	c->pass_start_usec = io_sched_now();
+	wait = c->pass_start_usec - c->enqueue_usec;
+	c->wait_usec += wait;
+	if (wait > c->max_wait_usec) c->max_wait_usec = wait;
+
+	return c;
+}
+
+/**
+ * 本次最多可以传输多少字节
+ *
+ * @param c 连接的调度状态
+ * @param limit 原有的上限，如li_tunables.max_write_limit
+ *
+ * @return 额度和limit中较小的一个
+ */
+size_t io_sched_budget(io_sched_conn *c, size_t limit) {
+	return c->deficit < limit ? c->deficit : limit;
+}
+
+/**
+ * 记录一次读或写传输的字节数，并判断是否还可以继续
+ *
+ * @param s 调度器
+ * @param c 连接的调度状态
+ * @param len 传输的字节数
+ * @param is_write 1为写，0为读
+ *
+ * @return 额度和时间都还有剩余返回HANDLER_GO_ON，
+ *         否则返回HANDLER_COMEBACK，调用者应停止传输
+ */
+handler_t io_sched_charge(io_sched *s, io_sched_conn *c, size_t len, int is_write) {
+	if (is_write) {
+		c->bytes_written += len;
+	} else {
+		c->bytes_read += len;
+	}
+
+	c->deficit = len < c->deficit ? c->deficit - len : 0;
+	if (c->deficit == 0) return HANDLER_COMEBACK;
+
+	if (s->time_budget_usec &&
+	    io_sched_now() - c->pass_start_usec >= s->time_budget_usec) {
+		return HANDLER_COMEBACK;
+	}
+
+	return HANDLER_GO_ON;
+}
+
+/**
+ * 一次调度结束
+ *
+ * HANDLER_COMEBACK表示还有数据但额度用完了，放回队尾，
+ * 剩下的额度留到下一轮；其它情况(等待事件、完成、出错)
+ * 说明连接不再就绪，额度清零，等事件到来时再io_sched_enqueue
+ *
+ * @param s 调度器
+ * @param c 连接的调度状态
+ * @param r 这次处理的结果
+ */
+void io_sched_done(io_sched *s, io_sched_conn *c, handler_t r) {
+	if (r == HANDLER_COMEBACK) {
+		c->comebacks++;
+		io_sched_enqueue(s, c);
+	} else {
+		c->deficit = 0;
+	}
+}
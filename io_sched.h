@@ -0,0 +1,67 @@
+
+/**
+ * 连接之间公平分配I/O的调度器
+ *
+ * 按deficit round robin(DRR)的方式，每个就绪的连接每轮得到
+ * quantum字节的额度，用完就返回HANDLER_COMEBACK排到队尾，
+ * 这样一个大流量的连接不会在一轮事件循环中占满
+ * MAX_READ_LIMIT/MAX_WRITE_LIMIT，让小请求等待
+ *
+ * 每轮只调度开始时已在队列中的连接，放回队尾的连接
+ * 留到下一轮，事件循环因此总能回去处理新的事件
+ */
+
+#ifndef _IO_SCHED_H_
+#define _IO_SCHED_H_
+
+#include "settings.h"
+
+#include <sys/types.h>
+#include <stdint.h>
+
+typedef struct io_sched_conn {
+	size_t deficit;              /* 本轮还可以传输的字节数 */
+
+	/* 统计，调用者可以随时读取 */
+	uint64_t bytes_read;
+	uint64_t bytes_written;
+	uint64_t passes;             /* 被调度的次数 */
+	uint64_t comebacks;          /* 额度或时间用完被放回队尾的次数 */
+	uint64_t wait_usec;          /* 在队列中等待的总时间 */
+	uint64_t max_wait_usec;      /* 单次等待的最长时间 */
+
+	uint64_t enqueue_usec;       /* 进入队列的时间 */
+	uint64_t pass_start_usec;    /* 本次被调度的开始时间 */
+
+	int queued;
+	uint64_t round;              /* 排在哪一轮，与io_sched.round比较 */
+	struct io_sched_conn *next;
+
+	void *ctx;                   /* 调用者的数据，一般为connection */
+} io_sched_conn;
+
+typedef struct {
+	io_sched_conn *head;
+	io_sched_conn *tail;
+	size_t used;                 /* 队列中的连接数 */
+
+	size_t round_left;           /* 本轮还要调度的连接数 */
+	int round_active;            /* 正在一轮之中 */
+	uint64_t round;              /* 当前这一轮的编号，每轮开始时加1 */
+
+	size_t quantum;              /* 每轮增加的额度，0表示取li_tunables.max_write_limit的1/4 */
+	uint64_t time_budget_usec;   /* 每次调度的时间上限，0表示不限制 */
+} io_sched;
+
+void io_sched_init(io_sched *s, size_t quantum, uint64_t time_budget_usec);
+void io_sched_conn_init(io_sched_conn *c, void *ctx);
+
+void io_sched_enqueue(io_sched *s, io_sched_conn *c);
+void io_sched_remove(io_sched *s, io_sched_conn *c);
+io_sched_conn *io_sched_next(io_sched *s);
+
+size_t io_sched_budget(io_sched_conn *c, size_t limit);
+handler_t io_sched_charge(io_sched *s, io_sched_conn *c, size_t len, int is_write);
+void io_sched_done(io_sched *s, io_sched_conn *c, handler_t r);
+
+#endif
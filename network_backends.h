@@ -0,0 +1,139 @@
+#ifndef _NETWORK_BACKENDS_H_
+#define _NETWORK_BACKENDS_H_
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include "buffer.h"
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+/**
+ * 从内核取得的TCP发送状态
+ */
+typedef struct {
+	unsigned int cwnd_bytes; /* 拥塞窗口，cwnd * mss */
+	unsigned int mss;
+	unsigned int rtt_usec;   /* 平滑后的rtt */
+	unsigned int queued;     /* 发送队列中的字节，包括已发出未确认的 */
+	unsigned int unsent;     /* 发送队列中还没有发出的字节 */
+} network_tcp_feedback;
+
+/**
+ * 一个连接的写出节奏，一般嵌在connection中
+ *
+ * 每次可写时只取一次内核的状态，算出的额度在这次的
+ * 多次写之间扣减，写完调用network_write_pass_end
+ */
+typedef struct {
+	unsigned int notsent_lowat; /* network_set_notsent_lowat设置的值，0表示没有设置 */
+	size_t budget;              /* 这次还可以写的字节数 */
+	int sampled;                /* 这次已经取过内核的状态 */
+} network_tcp_pacing;
+
+int network_tcp_get_feedback(int fd, network_tcp_feedback *fb);
+void network_tcp_pacing_init(network_tcp_pacing *p);
+size_t network_write_budget(int fd, network_tcp_pacing *p, size_t limit);
+void network_write_charge(network_tcp_pacing *p, size_t len);
+void network_write_pass_end(network_tcp_pacing *p);
+int network_set_notsent_lowat(int fd, network_tcp_pacing *p, unsigned int bytes);
+
+/**
+ * 输出中的一段文件，由network_file_range_write直接从文件发送到socket
+ */
+typedef struct {
+	int fd;                 /* 文件 */
+	off_t offset;           /* 下一个要发送的字节在文件中的位置 */
+	off_t length;           /* 还要发送的字节数 */
+
+	int pipe_fd[2];         /* splice使用的管道，-1表示没有 */
+	size_t in_pipe;         /* 已经进入管道还没有写到socket的字节数 */
+} network_file_range;
+
+void network_file_range_init(network_file_range *r, int fd, off_t offset, off_t length);
+void network_file_range_free(network_file_range *r);
+int network_file_range_write(int sock, network_file_range *r);
+
+/**
+ * 两个socket之间经过管道用splice转发，数据不经过用户空间
+ *
+ * 用于反向代理中不需要查看或修改的响应体，
+ * 需要修改时用network_splice_relay_to_buffer取出管道中剩余的数据，
+ * 之后改走buffer
+ */
+typedef struct {
+	int pipe_fd[2];
+	size_t in_pipe;         /* 管道中的字节数 */
+	size_t pipe_max;        /* 管道的容量，in_pipe达到它时停止读 */
+	int pipe_full;          /* 管道的槽位用完了，写出一些之前不再读 */
+
+	off_t bytes_in;         /* 统计，从源读到的字节数 */
+	off_t bytes_out;        /* 统计，写到目的的字节数 */
+} network_splice_relay;
+
+int network_splice_relay_init(network_splice_relay *s);
+void network_splice_relay_free(network_splice_relay *s);
+int network_splice_relay_want_read(network_splice_relay *s);
+int network_splice_relay_read(int from, network_splice_relay *s);
+int network_splice_relay_write(int to, network_splice_relay *s);
+int network_splice_relay_to_buffer(network_splice_relay *s, buffer *b);
+
+/**
+ * io_uring后端
+ *
+ * 读写都先放进提交队列，每轮事件循环调用一次network_uring_submit
+ * 一起提交，完成的操作由network_uring_reap取回。
+ * 没有liburing或内核不支持时network_uring_init返回NULL，
+ * 调用者继续使用read/writev
+ */
+#define NETWORK_URING_IOV_MAX 16
+
+typedef enum {
+	NETWORK_URING_UNSET,
+	NETWORK_URING_READ,          /* 读到read_buffer */
+	NETWORK_URING_READ_BUFFER,   /* 读到buffer的末尾 */
+	NETWORK_URING_READ_PROVIDED, /* 读到内核选择的预备缓冲区 */
+	NETWORK_URING_WRITEV         /* 写出buffer_array */
+} network_uring_op_t;
+
+/**
+ * 一次提交的操作，一般嵌在connection中
+ *
+ * 在完成之前，op以及它指向的read_buffer/buffer都不能被移动或释放
+ */
+typedef struct {
+	network_uring_op_t type;
+	int fd;
+	int pending;            /* 已经放入提交队列，还没有取回 */
+
+	read_buffer *rb;
+	buffer *b;
+
+	struct iovec iov[NETWORK_URING_IOV_MAX];
+	struct msghdr msg;
+
+	char *pbuf;             /* READ_PROVIDED时数据所在的预备缓冲区 */
+	int bid;                /* 预备缓冲区的编号，-1表示没有 */
+
+	ssize_t res;            /* 结果，>= 0为字节数，< 0为-errno */
+	void *ctx;              /* 调用者的数据，一般为connection */
+} network_uring_op;
+
+typedef struct network_uring network_uring;
+
+network_uring *network_uring_init(unsigned int entries);
+void network_uring_free(network_uring *u);
+
+int network_uring_read(network_uring *u, network_uring_op *op, int fd, read_buffer *rb);
+int network_uring_read_buffer(network_uring *u, network_uring_op *op, int fd, buffer *b);
+int network_uring_read_provided(network_uring *u, network_uring_op *op, int fd);
+void network_uring_recycle(network_uring *u, network_uring_op *op);
+int network_uring_writev(network_uring *u, network_uring_op *op, int fd, buffer_array *ba, size_t offset);
+
+int network_uring_submit(network_uring *u);
+size_t network_uring_reap(network_uring *u, network_uring_op **done, size_t max);
+
+#endif
@@ -0,0 +1,432 @@
+
+/**
+ * 记住一条:提交之后到取回之前，内核随时可能写op指向的内存，
+ * 这期间不能移动或释放buffer，也不能关闭fd
+ *
+ * 典型的用法，每轮事件循环:
+ *
+ *	... 对可读的连接network_uring_read，有数据要写的network_uring_writev ...
+ *	network_uring_submit(u);
+ *	n = network_uring_reap(u, done, 64);
+ *	for (i = 0; i < n; i++) {
+ *		... done[i]->res < 0为-errno，0为对端关闭，否则为字节数 ...
+ *	}
+ */
+
+#include "network_backends.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef HAVE_LIBURING
+# include <liburing.h>
+
+#define NETWORK_URING_PBUF_GROUP 1
+#define NETWORK_URING_PBUF_COUNT 256
+#define NETWORK_URING_PBUF_SIZE  (16 * 1024)
+
+struct network_uring {
+	struct io_uring ring;
+	unsigned int queued;    /* 放入提交队列还没有提交的个数 */
+
+	char *pbuf;             /* 预备缓冲区，NULL表示内核不支持 */
+};
+
+/**
+ * 取一个提交队列的位置，满了就先提交一次
+ */
+static struct io_uring_sqe *network_uring_get_sqe(network_uring *u) {
+	struct io_uring_sqe *sqe;
+
+	if (NULL != (sqe = io_uring_get_sqe(&u->ring))) return sqe;
+
+	network_uring_submit(u);
+
+	return io_uring_get_sqe(&u->ring);
+}
+
+/**
+ * 把一个预备缓冲区交给内核
+ */
+static int network_uring_provide(network_uring *u, int bid, int nr) {
+	struct io_uring_sqe *sqe;
+
+	if (NULL == (sqe = network_uring_get_sqe(u))) return -1;
+
+	io_uring_prep_provide_buffers(sqe, u->pbuf + (size_t)bid * NETWORK_URING_PBUF_SIZE,
+		NETWORK_URING_PBUF_SIZE, nr, NETWORK_URING_PBUF_GROUP, bid);
+	io_uring_sqe_set_data(sqe, NULL);
+	u->queued++;
+
+	return 0;
+}
+
+/**
+ * 初始化
+ *
+ * 预备缓冲区需要5.7以上的内核，不支持时只是不能用
+ * network_uring_read_provided，其它操作不受影响
+ *
+ * @param entries 提交队列的大小
+ *
+ * @return 成功返回network_uring，失败返回NULL，调用者应使用原来的读写方式
+ */
+network_uring *network_uring_init(unsigned int entries) {
+	struct io_uring_cqe *cqe;
+	network_uring *u;
+
+	u = calloc(1, sizeof(*u));
+	assert(u);
+
+	if (io_uring_queue_init(entries ? entries : 256, &u->ring, 0) < 0) {
+		free(u);
+		return NULL;
+	}
+
+	u->pbuf = malloc((size_t)NETWORK_URING_PBUF_COUNT * NETWORK_URING_PBUF_SIZE);
+	assert(u->pbuf);
+
+	if (0 != network_uring_provide(u, 0, NETWORK_URING_PBUF_COUNT) ||
+	    io_uring_submit(&u->ring) < 0 ||
+	    io_uring_wait_cqe(&u->ring, &cqe) < 0) {
+		free(u->pbuf);
+		u->pbuf = NULL;
+	} else {
+		if (cqe->res < 0) {
+			free(u->pbuf);
+			u->pbuf = NULL;
+		}
+		io_uring_cqe_seen(&u->ring, cqe);
+	}
+	u->queued = 0;
+
+	return u;
+}
+
+/**
+ * 释放
+ *
+ * 还在进行中的操作被丢弃，调用者应在此之前关闭所有相关的fd
+ */
+void network_uring_free(network_uring *u) {
+	if (!u) return;
+
+	io_uring_queue_exit(&u->ring);
+	free(u->pbuf);
+	free(u);
+}
+
+static int network_uring_prep_recv(network_uring *u, network_uring_op *op, int fd, char *p, size_t len) {
+	struct io_uring_sqe *sqe;
+
+	if (op->pending) return -1;
+	if (NULL == (sqe = network_uring_get_sqe(u))) return -1;
+
+	if (len > li_tunables.max_read_limit) len = li_tunables.max_read_limit;
+
+	io_uring_prep_recv(sqe, fd, p, len, 0);
+	io_uring_sqe_set_data(sqe, op);
+
+	op->fd = fd;
+	op->pending = 1;
+	op->bid = -1;
+	op->pbuf = NULL;
+	op->res = 0;
+	u->queued++;
+
+	return 0;
+}
+
+/**
+ * 提交一次读，数据直接读到rb->ptr + rb->used
+ *
+ * 调用者事先保证rb有空间，完成时rb->used增加读到的字节数
+ *
+ * @return 成功返回0，rb没有空间或提交队列满返回-1
+ */
+int network_uring_read(network_uring *u, network_uring_op *op, int fd, read_buffer *rb) {
+	if (rb->used >= rb->size) return -1;
+	if (0 != network_uring_prep_recv(u, op, fd, rb->ptr + rb->used, rb->size - rb->used)) return -1;
+
+	op->type = NETWORK_URING_READ;
+	op->rb = rb;
+	op->b = NULL;
+
+	return 0;
+}
+
+/**
+ * 提交一次读，数据追加到b的末尾
+ *
+ * 先为b准备li_tunables.max_read_limit的空间，完成之前b不能再修改。
+ * op上还有读在进行时b可能正被内核写入，这时不能动b，直接返回
+ *
+ * @return 成功返回0，op上已有操作在进行或提交队列满返回-1
+ */
+int network_uring_read_buffer(network_uring *u, network_uring_op *op, int fd, buffer *b) {
+	size_t len = li_tunables.max_read_limit;
+
+	if (op->pending) return -1;
+
+	buffer_prepare_append(b, len + 1);
+	if (b->used == 0) {
+		b->ptr[0] = '\0';
+		b->used = 1;
+	}
+
+	if (0 != network_uring_prep_recv(u, op, fd, b->ptr + b->used - 1, len)) return -1;
+
+	op->type = NETWORK_URING_READ_BUFFER;
+	op->b = b;
+	op->rb = NULL;
+
+	return 0;
+}
+
+/**
+ * 提交一次读，由内核在预备缓冲区中挑一个
+ *
+ * 空闲的连接不用各自占着读缓冲区。完成后数据位于op->pbuf，
+ * 调用者复制出来之后要调用network_uring_recycle
+ *
+ * @return 成功返回0，不支持预备缓冲区或提交队列满返回-1
+ */
+int network_uring_read_provided(network_uring *u, network_uring_op *op, int fd) {
+	struct io_uring_sqe *sqe;
+
+	if (u->pbuf == NULL || op->pending) return -1;
+	if (NULL == (sqe = network_uring_get_sqe(u))) return -1;
+
+	io_uring_prep_recv(sqe, fd, NULL, NETWORK_URING_PBUF_SIZE, 0);
+	sqe->flags |= IOSQE_BUFFER_SELECT;
+	sqe->buf_group = NETWORK_URING_PBUF_GROUP;
+	io_uring_sqe_set_data(sqe, op);
+
+	op->type = NETWORK_URING_READ_PROVIDED;
+	op->fd = fd;
+	op->pending = 1;
+	op->rb = NULL;
+	op->b = NULL;
+	op->bid = -1;
+	op->pbuf = NULL;
+	op->res = 0;
+	u->queued++;
+
+	return 0;
+}
+
+/**
+ * 归还预备缓冲区，随下一次提交一起交给内核
+ */
+void network_uring_recycle(network_uring *u, network_uring_op *op) {
+	if (op->bid == -1) return;
+
+	network_uring_provide(u, op->bid, 1);
+	op->bid = -1;
+	op->pbuf = NULL;
+}
+
+/**
+ * 提交一次写，把ba中的各个buffer一起写出
+ *
+ * 写出的总长度不超过li_tunables.max_write_limit，最多
+ * NETWORK_URING_IOV_MAX个buffer。用sendmsg而不是writev，
+ * 这样可以带上MSG_NOSIGNAL
+ *
+ * @param offset 跳过前面已经写出的字节数
+ *
+ * @return 成功返回0，没有要写的数据或提交队列满返回-1
+ */
+int network_uring_writev(network_uring *u, network_uring_op *op, int fd, buffer_array *ba, size_t offset) {
+	struct io_uring_sqe *sqe;
+	size_t i, len, total = 0;
+	int n = 0;
+	buffer *b;
+
+	if (op->pending) return -1;
+
+	for (i = 0; i < ba->used && n < NETWORK_URING_IOV_MAX && total < li_tunables.max_write_limit; i++) {
+		b = ba->ptr[i];
+		if (b->used <= 1) continue;
+
+		len = b->used - 1;
+		if (offset >= len) {
+			offset -= len;
+			continue;
+		}
+
+		op->iov[n].iov_base = b->ptr + offset;
+		op->iov[n].iov_len = len - offset;
+		offset = 0;
+
+		if (total + op->iov[n].iov_len > li_tunables.max_write_limit) {
+			op->iov[n].iov_len = li_tunables.max_write_limit - total;
+		}
+		total += op->iov[n].iov_len;
+		n++;
+	}
+
+	if (n == 0) return -1;
+	if (NULL == (sqe = network_uring_get_sqe(u))) return -1;
+
+	memset(&op->msg, 0, sizeof(op->msg));
+	op->msg.msg_iov = op->iov;
+	op->msg.msg_iovlen = n;
+
+	io_uring_prep_sendmsg(sqe, fd, &op->msg, MSG_NOSIGNAL);
+	io_uring_sqe_set_data(sqe, op);
+
+	op->type = NETWORK_URING_WRITEV;
+	op->fd = fd;
+	op->pending = 1;
+	op->rb = NULL;
+	op->b = NULL;
+	op->bid = -1;
+	op->pbuf = NULL;
+	op->res = 0;
+	u->queued++;
+
+	return 0;
+}
+
+/**
+ * 提交队列中的所有操作，每轮事件循环调用一次
+ *
+ * @return 提交的个数，出错返回-1
+ */
+int network_uring_submit(network_uring *u) {
+	int r;
+
+	if (u->queued == 0) return 0;
+
+	if ((r = io_uring_submit(&u->ring)) < 0) return -1;
+	u->queued = 0;
+
+	return r;
+}
+
+/**
+ * 取回已完成的操作，不等待
+ *
+ * 读操作的结果已经记入对应的read_buffer或buffer
+ *
+ * @param done 保存完成的操作
+ * @param max done的大小
+ *
+ * @return 取回的个数
+ */
+size_t network_uring_reap(network_uring *u, network_uring_op **done, size_t max) {
+	struct io_uring_cqe *cqe;
+	network_uring_op *op;
+	size_t n = 0;
+
+	while (n < max && 0 == io_uring_peek_cqe(&u->ring, &cqe)) {
+		op = io_uring_cqe_get_data(cqe);
+
+		if (op == NULL) {
+			/* 归还预备缓冲区的结果，不需要处理 */
+			io_uring_cqe_seen(&u->ring, cqe);
+			continue;
+		}
+
+		op->res = cqe->res;
+		op->pending = 0;
+
+		if (cqe->res > 0) {
+			switch (op->type) {
+			case NETWORK_URING_READ:
+				op->rb->used += cqe->res;
+				break;
+			case NETWORK_URING_READ_BUFFER:
+				op->b->used += cqe->res;
+				op->b->ptr[op->b->used - 1] = '\0';
+				break;
+			default:
+				break;
+			}
+
+			/* 完成事件在主循环中取回，可以直接调整读写的上限 */
+			if (li_tunables.adaptive) {
+				if (op->type == NETWORK_URING_WRITEV) {
+					tunables_observe_write(cqe->res);
+				} else {
+					tunables_observe_read(cqe->res);
+				}
+			}
+		}
+
+		if (op->type == NETWORK_URING_READ_PROVIDED && (cqe->flags & IORING_CQE_F_BUFFER)) {
+			op->bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+			op->pbuf = u->pbuf + (size_t)op->bid * NETWORK_URING_PBUF_SIZE;
+		}
+
+		io_uring_cqe_seen(&u->ring, cqe);
+		done[n++] = op;
+	}
+
+	return n;
+}
+
+#else
+
+network_uring *network_uring_init(unsigned int entries) {
+	UNUSED(entries);
+	return NULL;
+}
+
+void network_uring_free(network_uring *u) {
+	UNUSED(u);
+}
+
+int network_uring_read(network_uring *u, network_uring_op *op, int fd, read_buffer *rb) {
+	UNUSED(u);
+	UNUSED(op);
+	UNUSED(fd);
+	UNUSED(rb);
+	return -1;
+}
+
+int network_uring_read_buffer(network_uring *u, network_uring_op *op, int fd, buffer *b) {
+	UNUSED(u);
+	UNUSED(op);
+	UNUSED(fd);
+	UNUSED(b);
+	return -1;
+}
+
+int network_uring_read_provided(network_uring *u, network_uring_op *op, int fd) {
+	UNUSED(u);
+	UNUSED(op);
+	UNUSED(fd);
+	return -1;
+}
+
+void network_uring_recycle(network_uring *u, network_uring_op *op) {
+	UNUSED(u);
+	UNUSED(op);
+}
+
+int network_uring_writev(network_uring *u, network_uring_op *op, int fd, buffer_array *ba, size_t offset) {
+	UNUSED(u);
+	UNUSED(op);
+	UNUSED(fd);
+	UNUSED(ba);
+	UNUSED(offset);
+	return -1;
+}
+
+int network_uring_submit(network_uring *u) {
+	UNUSED(u);
+	return -1;
+}
+
+size_t network_uring_reap(network_uring *u, network_uring_op **done, size_t max) {
+	UNUSED(u);
+	UNUSED(done);
+	UNUSED(max);
+	return 0;
+}
+
+#endif
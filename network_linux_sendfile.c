@@ -0,0 +1,166 @@
+
+/**
+ * 记住一条:文件的数据不经过用户空间，offset和length都是off_t，
+ * 大于2G的文件在32位系统上也不会出错(需要_FILE_OFFSET_BITS=64)
+ *
+ * 先用sendfile，文件系统不支持时(EINVAL/ENOSYS)改用splice
+ * 经过一个管道转发。其它系统用pread/write，仍然要复制一次
+ */
+
+#include "network_backends.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef __linux__
+# include <sys/sendfile.h>
+#endif
+
+/**
+ * 初始化一段文件
+ *
+ * @param r 文件段
+ * @param fd 打开的文件，一般来自stat_cache_entry的fd，不由r关闭
+ * @param offset 开始的位置
+ * @param length 要发送的字节数
+ */
+void network_file_range_init(network_file_range *r, int fd, off_t offset, off_t length) {
+	memset(r, 0, sizeof(*r));
+	r->fd = fd;
+	r->offset = offset;
+	r->length = length;
+	r->pipe_fd[0] = r->pipe_fd[1] = -1;
+}
+
+/**
+ * 释放splice用的管道，不关闭文件
+ */
+void network_file_range_free(network_file_range *r) {
+	if (r->pipe_fd[0] != -1) close(r->pipe_fd[0]);
+	if (r->pipe_fd[1] != -1) close(r->pipe_fd[1]);
+	r->pipe_fd[0] = r->pipe_fd[1] = -1;
+	r->in_pipe = 0;
+}
+
+/**
+ * 写出错时的返回值
+ */
+static int network_file_range_error(void) {
+	switch (errno) {
+	case EAGAIN:
+	case EINTR:
+		return 1;
+	case EPIPE:
+	case ECONNRESET:
+		return -2;
+	default:
+		return -1;
+	}
+}
+
+#ifdef __linux__
+/**
+ * 把管道中的数据写到socket
+ *
+ * @return 管道已空返回0，socket写不下(EAGAIN)返回1，出错返回-1或-2
+ */
+static int network_file_range_drain(int sock, network_file_range *r) {
+	ssize_t n;
+
+	while (r->in_pipe > 0) {
+		n = splice(r->pipe_fd[0], NULL, sock, NULL, r->in_pipe, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+		if (n == -1) return network_file_range_error();
+		/* 管道中还有数据却一个字节也没写出，不是写不下(那是EAGAIN)，
+		 * 当作出错，免得等一个永远不来的可写事件 */
+		if (n == 0) return -1;
+
+		r->in_pipe -= n;
+		if (li_tunables.adaptive) tunables_observe_write(n);
+	}
+
+	return 0;
+}
+#endif
+
+/**
+ * 发送一段文件的一部分
+ *
+ * 每次最多发送li_tunables.max_write_limit字节，和写buffer时一样，
+ * 一个大文件不会在一轮事件循环中占满
+ *
+ * @param sock socket，应为非阻塞
+ * @param r 文件段，offset和length随发送更新
+ *
+ * @return 全部发送完返回0，还有剩余(等待可写或下一轮)返回1，
+ *         出错返回-1，对端已关闭返回-2
+ */
+int network_file_range_write(int sock, network_file_range *r) {
+	off_t len;
+	ssize_t n;
+#ifdef __linux__
+	int ret;
+#else
+	char buf[16 * 1024];
+	ssize_t w;
+#endif
+
+	if (r->length == 0 && r->in_pipe == 0) return 0;
+
+	len = r->length;
+	if (len > (off_t)li_tunables.max_write_limit) len = li_tunables.max_write_limit;
+
+#ifdef __linux__
+	if (r->pipe_fd[0] == -1) {
+		if (len == 0) return 0;
+
+		n = sendfile(sock, r->fd, &r->offset, len);
+		if (n > 0) {
+			r->length -= n;
+			if (li_tunables.adaptive) tunables_observe_write(n);
+			return r->length ? 1 : 0;
+		}
+		/* 文件在发送过程中被截短了 */
+		if (n == 0) return -1;
+
+		if (errno != EINVAL && errno != ENOSYS) return network_file_range_error();
+
+		if (-1 == pipe(r->pipe_fd)) {
+			r->pipe_fd[0] = r->pipe_fd[1] = -1;
+			return -1;
+		}
+		fcntl(r->pipe_fd[0], F_SETFD, FD_CLOEXEC);
+		fcntl(r->pipe_fd[1], F_SETFD, FD_CLOEXEC);
+	}
+
+	/* 先把上次留在管道中的数据写出去 */
+	if (0 != (ret = network_file_range_drain(sock, r))) return ret;
+	if (len == 0) return 0;
+
+	n = splice(r->fd, &r->offset, r->pipe_fd[1], NULL, len, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+	if (n == -1) return network_file_range_error();
+	if (n == 0) return -1;
+
+	r->length -= n;
+	r->in_pipe += n;
+
+	if (0 != (ret = network_file_range_drain(sock, r))) return ret;
+
+	return r->length ? 1 : 0;
+#else
+	if (len > (off_t)sizeof(buf)) len = sizeof(buf);
+
+	n = pread(r->fd, buf, len, r->offset);
+	if (n == -1) return -1;
+	if (n == 0) return -1;
+
+	if (-1 == (w = write(sock, buf, n))) return network_file_range_error();
+
+	r->offset += w;
+	r->length -= w;
+	if (li_tunables.adaptive) tunables_observe_write(w);
+
+	return r->length ? 1 : 0;
+#endif
+}
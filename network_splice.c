@@ -0,0 +1,227 @@
+
+/**
+ * 记住一条:背压靠管道的容量，管道满了就不再关注源的可读事件，
+ * 直到目的把数据取走
+ *
+ * 管道的容量按槽位计算而不是字节，从socket splice时每个skb的分片
+ * 占一个槽位(一般一页)，小包多时远没到pipe_max字节管道就满了。
+ * 所以除了字节数，还记下splice因管道满而返回的EAGAIN
+ *
+ * 典型的用法:
+ *
+ *	if (0 != network_splice_relay_init(&hctx->relay)) ... 改走buffer ...
+ *
+ *	源可读时:
+ *		r = network_splice_relay_read(hctx->fd, &hctx->relay);
+ *	目的可写时:
+ *		r = network_splice_relay_write(con->fd, &hctx->relay);
+ *	每次之后:
+ *		源的读事件只在network_splice_relay_want_read时打开，
+ *		目的的写事件只在in_pipe > 0时打开
+ */
+
+#include "network_backends.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+
+/**
+ * 初始化，建立管道
+ *
+ * 管道的容量尽量调整为li_tunables.max_read_limit
+ *
+ * @return 成功返回0，系统不支持splice或建立管道失败返回-1，
+ *         调用者应改用buffer转发
+ */
+int network_splice_relay_init(network_splice_relay *s) {
+	memset(s, 0, sizeof(*s));
+	s->pipe_fd[0] = s->pipe_fd[1] = -1;
+
+#if defined(__linux__) && defined(SPLICE_F_NONBLOCK)
+	if (-1 == pipe(s->pipe_fd)) {
+		s->pipe_fd[0] = s->pipe_fd[1] = -1;
+		return -1;
+	}
+	fcntl(s->pipe_fd[0], F_SETFD, FD_CLOEXEC);
+	fcntl(s->pipe_fd[1], F_SETFD, FD_CLOEXEC);
+
+	s->pipe_max = 64 * 1024;
+# ifdef F_SETPIPE_SZ
+	{
+		int sz;
+
+		fcntl(s->pipe_fd[1], F_SETPIPE_SZ, (int)li_tunables.max_read_limit);
+		if ((sz = fcntl(s->pipe_fd[1], F_GETPIPE_SZ)) > 0) s->pipe_max = sz;
+	}
+# endif
+
+	return 0;
+#else
+	return -1;
+#endif
+}
+
+/**
+ * 关闭管道，管道中的数据被丢弃
+ */
+void network_splice_relay_free(network_splice_relay *s) {
+	if (s->pipe_fd[0] != -1) close(s->pipe_fd[0]);
+	if (s->pipe_fd[1] != -1) close(s->pipe_fd[1]);
+	s->pipe_fd[0] = s->pipe_fd[1] = -1;
+	s->in_pipe = 0;
+	s->pipe_full = 0;
+}
+
+/**
+ * 是否还应该从源读
+ *
+ * @return 管道没有满返回1，否则返回0
+ */
+int network_splice_relay_want_read(network_splice_relay *s) {
+	return !s->pipe_full && s->in_pipe < s->pipe_max;
+}
+
+/**
+ * splice返回EAGAIN时判断是源没有数据还是管道满了
+ *
+ * 管道是空的就不可能满；否则看源中还有没有可读的数据，
+ * 取不到时按管道满处理，等写出一些之后再读，不会丢失读事件
+ *
+ * @return 管道满返回1，源没有数据返回0
+ */
+static int network_splice_relay_pipe_full(int from, network_splice_relay *s) {
+	int avail = 0;
+
+	if (s->in_pipe == 0) return 0;
+	if (0 == ioctl(from, FIONREAD, &avail) && avail == 0) return 0;
+
+	return 1;
+}
+
+/**
+ * 从源socket读到管道
+ *
+ * 最多读li_tunables.max_read_limit字节，也不超过管道的剩余空间
+ *
+ * @param from 源socket，应为非阻塞
+ *
+ * @return 源已关闭返回0，读到数据或暂时没有数据返回1，
+ *         管道满返回2，出错返回-1。返回2之后network_splice_relay_want_read
+ *         为0，直到network_splice_relay_write写出了数据
+ */
+int network_splice_relay_read(int from, network_splice_relay *s) {
+#if defined(__linux__) && defined(SPLICE_F_NONBLOCK)
+	size_t len;
+	ssize_t n;
+
+	if (!network_splice_relay_want_read(s)) return 2;
+
+	len = s->pipe_max - s->in_pipe;
+	if (len > li_tunables.max_read_limit) len = li_tunables.max_read_limit;
+
+	n = splice(from, NULL, s->pipe_fd[1], NULL, len, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+	if (n == -1) {
+		if (errno == EINTR) return 1;
+		if (errno != EAGAIN) return -1;
+
+		if (network_splice_relay_pipe_full(from, s)) {
+			s->pipe_full = 1;
+			return 2;
+		}
+		return 1;
+	}
+	if (n == 0) return 0;
+
+	s->in_pipe += n;
+	s->bytes_in += n;
+	if (li_tunables.adaptive) tunables_observe_read(n);
+
+	return 1;
+#else
+	UNUSED(from);
+	UNUSED(s);
+	return -1;
+#endif
+}
+
+/**
+ * 把管道中的数据写到目的socket
+ *
+ * 最多写li_tunables.max_write_limit字节
+ *
+ * @param to 目的socket，应为非阻塞
+ *
+ * @return 管道已空返回0，还有剩余返回1，出错返回-1，对端已关闭返回-2
+ */
+int network_splice_relay_write(int to, network_splice_relay *s) {
+#if defined(__linux__) && defined(SPLICE_F_NONBLOCK)
+	size_t len;
+	ssize_t n;
+
+	if (s->in_pipe == 0) return 0;
+
+	len = s->in_pipe;
+	if (len > li_tunables.max_write_limit) len = li_tunables.max_write_limit;
+
+	n = splice(s->pipe_fd[0], NULL, to, NULL, len, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+	if (n == -1) {
+		switch (errno) {
+		case EAGAIN:
+		case EINTR:
+			return 1;
+		case EPIPE:
+		case ECONNRESET:
+			return -2;
+		default:
+			return -1;
+		}
+	}
+
+	s->in_pipe -= n;
+	s->bytes_out += n;
+	if (n > 0) {
+		s->pipe_full = 0;
+		if (li_tunables.adaptive) tunables_observe_write(n);
+	}
+
+	return s->in_pipe ? 1 : 0;
+#else
+	UNUSED(to);
+	UNUSED(s);
+	return -1;
+#endif
+}
+
+/**
+ * 把管道中剩余的数据追加到b，用于从splice转为buffer转发
+ *
+ * @return 成功返回0，出错返回-1
+ */
+int network_splice_relay_to_buffer(network_splice_relay *s, buffer *b) {
+	ssize_t n;
+
+	while (s->in_pipe > 0) {
+		buffer_prepare_append(b, s->in_pipe + 1);
+		if (b->used == 0) {
+			b->ptr[0] = '\0';
+			b->used = 1;
+		}
+
+		n = read(s->pipe_fd[0], b->ptr + b->used - 1, s->in_pipe);
+		if (n == -1) {
+			if (errno == EINTR) continue;
+			return -1;
+		}
+		if (n == 0) return -1;
+
+		b->used += n;
+		b->ptr[b->used - 1] = '\0';
+		s->in_pipe -= n;
+	}
+	s->pipe_full = 0;
+
+	return 0;
+}
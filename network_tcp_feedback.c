@@ -0,0 +1,184 @@
+/**
+ * 根据内核的发送队列状态决定每次写多少
+ *
+ * 固定写满MAX_WRITE_LIMIT时，慢速客户端的数据只是堆在内核的
+ * 发送队列里，下次可写时又要多一次系统调用；快速的链路上
+ * 又可能写得不够。这里根据拥塞窗口和队列中尚未发出的字节数
+ * 计算本次应写的字节数
+ *
+ * 典型的用法，每次socket可写时:
+ *
+ *	while (还有数据) {
+ *		len = network_write_budget(fd, &con->pacing, li_tunables.max_write_limit);
+ *		if (len == 0) break;
+ *		... 最多写len个字节，写了n个 ...
+ *		network_write_charge(&con->pacing, n);
+ *	}
+ *	network_write_pass_end(&con->pacing);
+ */
+
+#include "network_backends.h"
+
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#ifdef __linux__
+# include <linux/sockios.h>
+#endif
+
+/**
+ * 读取socket的TCP发送状态
+ *
+ * cwnd、mss和rtt来自TCP_INFO，尚未发出的字节来自SIOCOUTQNSD，
+ * 一共两次系统调用。队列长度由unsent加上已发出未确认的段数乘mss
+ * 估算，不再单独调用SIOCOUTQ。旧内核不支持SIOCOUTQNSD时才
+ * 用SIOCOUTQ，unsent取queued，偏保守
+ *
+ * @param fd socket
+ * @param fb 保存结果
+ *
+ * @return 成功返回0，不是TCP socket或系统不支持返回-1
+ */
+int network_tcp_get_feedback(int fd, network_tcp_feedback *fb) {
+#if defined(__linux__) && defined(TCP_INFO) && defined(SIOCOUTQ)
+	struct tcp_info ti;
+	socklen_t len = sizeof(ti);
+	int queued, unsent;
+
+	memset(fb, 0, sizeof(*fb));
+
+	if (0 != getsockopt(fd, IPPROTO_TCP, TCP_INFO, &ti, &len)) return -1;
+
+	fb->mss = ti.tcpi_snd_mss;
+	fb->cwnd_bytes = ti.tcpi_snd_cwnd * ti.tcpi_snd_mss;
+	fb->rtt_usec = ti.tcpi_rtt;
+
+# ifdef SIOCOUTQNSD
+	if (0 == ioctl(fd, SIOCOUTQNSD, &unsent)) {
+		fb->unsent = unsent;
+		fb->queued = unsent + ti.tcpi_unacked * ti.tcpi_snd_mss;
+		return 0;
+	}
+# else
+	UNUSED(unsent);
+# endif
+
+	if (0 != ioctl(fd, SIOCOUTQ, &queued)) return -1;
+
+	fb->queued = queued;
+	fb->unsent = queued;
+
+	return 0;
+#else
+	UNUSED(fd);
+	UNUSED(fb);
+	return -1;
+#endif
+}
+
+/**
+ * 初始化一个连接的写出节奏
+ */
+void network_tcp_pacing_init(network_tcp_pacing *p) {
+	memset(p, 0, sizeof(*p));
+}
+
+/**
+ * 根据内核的状态计算这次一共应该写出多少字节
+ *
+ * 让内核里尚未发出的数据保持在大约一个拥塞窗口:
+ * 足够在下一批ACK到达时立即发送，又不会在慢速连接上
+ * 堆积过多。取不到状态时返回(size_t)-1，即不限制
+ *
+ * 窗口已经满了时，只有TCP_NOTSENT_LOWAT生效(未发出的数据
+ * 不少于阈值)才返回0，这时内核要等队列降下去才报告可写，
+ * 等待不会空转。否则可写事件会立即再来，返回0只会让事件循环
+ * 反复醒来，所以至少给一个mss，也保证不足一个mss的尾部能写出
+ */
+static size_t network_write_sample(int fd, network_tcp_pacing *p) {
+	network_tcp_feedback fb;
+	size_t budget;
+
+	if (0 != network_tcp_get_feedback(fd, &fb)) return (size_t)-1;
+	if (fb.cwnd_bytes == 0) return (size_t)-1;
+
+	budget = fb.unsent < fb.cwnd_bytes ? fb.cwnd_bytes - fb.unsent : 0;
+
+	if (budget < fb.mss) {
+		if (p->notsent_lowat > 0 && fb.unsent >= p->notsent_lowat) return 0;
+
+		budget = fb.mss;
+	}
+
+	return budget;
+}
+
+/**
+ * 计算这次应该写出多少字节
+ *
+ * 这次可写事件中第一次调用时取内核的状态，之后只从额度中
+ * 扣减，直到network_write_pass_end。结果不超过limit
+ *
+ * @param fd socket
+ * @param p 连接的写出节奏
+ * @param limit 原有的上限，一般为li_tunables.max_write_limit
+ *
+ * @return 本次应写的字节数，为0时应等待下一次可写事件
+ */
+size_t network_write_budget(int fd, network_tcp_pacing *p, size_t limit) {
+	if (!p->sampled) {
+		p->budget = network_write_sample(fd, p);
+		p->sampled = 1;
+	}
+
+	return p->budget < limit ? p->budget : limit;
+}
+
+/**
+ * 记录写出的字节数，从这次的额度中扣除
+ *
+ * @param p 连接的写出节奏
+ * @param len 写出的字节数
+ */
+void network_write_charge(network_tcp_pacing *p, size_t len) {
+	p->budget = len < p->budget ? p->budget - len : 0;
+}
+
+/**
+ * 这次可写事件处理完了，下一次network_write_budget重新取内核的状态
+ */
+void network_write_pass_end(network_tcp_pacing *p) {
+	p->sampled = 0;
+	p->budget = 0;
+}
+
+/**
+ * 设置TCP_NOTSENT_LOWAT
+ *
+ * 内核中尚未发出的数据少于bytes时才报告可写，
+ * 和network_write_budget配合，避免提前醒来却没什么可写。
+ * 设置成功的值记在p中，network_write_budget不必再读回来
+ *
+ * @param fd socket
+ * @param p 连接的写出节奏
+ * @param bytes 阈值，一般取一个拥塞窗口左右
+ *
+ * @return 成功返回0，不支持返回-1
+ */
+int network_set_notsent_lowat(int fd, network_tcp_pacing *p, unsigned int bytes) {
+#ifdef TCP_NOTSENT_LOWAT
+	if (0 != setsockopt(fd, IPPROTO_TCP, TCP_NOTSENT_LOWAT, &bytes, sizeof(bytes))) return -1;
+
+	p->notsent_lowat = bytes;
+
+	return 0;
+#else
+	UNUSED(fd);
+	UNUSED(p);
+	UNUSED(bytes);
+	return -1;
+#endif
+}
@@ -0,0 +1,294 @@
+
+/**
+ * 记住一条:这里的切分只记录位置，不复制内容，
+ * 所以在使用结果期间read_buffer的内存不能被移动或释放
+ */
+
+#include "request.h"
+
+#include <string.h>
+
+/**
+ * 查找行尾
+ *
+ * 用memchr找'\n'，libc里的memchr一般都是按字(甚至SIMD)
+ * 比较的，比逐字节判断快得多
+ *
+ * @return 找到返回'\n'的位置，否则返回NULL
+ */
+static const char *http_find_eol(const char *p, const char *end) {
+	return memchr(p, '\n', end - p);
+}
+
+/**
+ * 请求头结尾的匹配状态
+ */
+enum {
+	HDR_SCAN_NONE,   /* 在一行的中间 */
+	HDR_SCAN_LF,     /* 刚过了一个'\n' */
+	HDR_SCAN_LF_CR   /* "\n\r" */
+};
+
+/**
+ * 增量查找请求头的结尾
+ *
+ * 请求头常常分成很多个TCP包到达，如果每次read之后都从头
+ * 查找"\r\n\r\n"，慢速客户端会带来平方级的开销。这里把
+ * 扫描到的位置和部分匹配的状态保存在read_buffer里，
+ * 下次从断点继续，每个字节只检查一次。
+ * 和http_request_tokenize一样，也接受单独的"\n"作为行尾
+ *
+ * 找到之后状态被清零，调用者跳过这个请求头(修改offset)后
+ * 便可以查找下一个请求。移动缓冲区中的数据要用read_buffer_compact，
+ * 它会同时平移断点
+ *
+ * @param rb 保存数据和扫描状态的read_buffer，数据范围为[offset, used)
+ *
+ * @return 找到时返回请求头的长度(从offset算起，包括最后的空行)，
+ *         还需要更多数据返回0，超过li_tunables.max_http_request_header返回-1
+ */
+int http_request_header_end(read_buffer *rb) {
+	const char *p, *end, *eol;
+	size_t len;
+
+	if (!rb || !rb->ptr || rb->used < rb->offset) return -1;
+
+	if (rb->hdr_scan < rb->offset || rb->hdr_scan > rb->used) {
+		/**
+		 * offset被调用者移动过，或者数据被移动过却没有经过
+		 * read_buffer_compact，断点已经不可信，重新开始
+		 */
+		rb->hdr_scan = rb->offset;
+		rb->hdr_state = HDR_SCAN_NONE;
+	}
+
+	p = rb->ptr + rb->hdr_scan;
+	end = rb->ptr + rb->used;
+	if ((size_t)(end - (rb->ptr + rb->offset)) > li_tunables.max_http_request_header) {
+		end = rb->ptr + rb->offset + li_tunables.max_http_request_header;
+	}
+
+	while (p < end) {
+		switch (rb->hdr_state) {
+		case HDR_SCAN_NONE:
+			/* 行中间的字节不用逐个看，直接跳到下一个'\n' */
+			eol = http_find_eol(p, end);
+			if (eol == NULL) {
+				p = end;
+				break;
+			}
+			p = eol + 1;
+			rb->hdr_state = HDR_SCAN_LF;
+			break;
+		case HDR_SCAN_LF:
+		case HDR_SCAN_LF_CR:
+			if (*p == '\n') {
+				len = (p + 1) - (rb->ptr + rb->offset);
+				rb->hdr_scan = 0;
+				rb->hdr_state = HDR_SCAN_NONE;
+				return len;
+			}
+			rb->hdr_state = (*p == '\r' && rb->hdr_state == HDR_SCAN_LF) ?
+				HDR_SCAN_LF_CR : HDR_SCAN_NONE;
+			p++;
+			break;
+		}
+	}
+
+	rb->hdr_scan = p - rb->ptr;
+
+	if (rb->hdr_scan - rb->offset >= li_tunables.max_http_request_header) return -1;
+
+	return 0;
+}
+
+/**
+ * 切分请求行，如"GET /index.html HTTP/1.1"
+ *
+ * @param t 保存结果的对象
+ * @param p 行首
+ * @param le 行尾，不含"\r\n"
+ *
+ * @return 成功返回0，格式错误返回-1
+ */
+static int http_request_tokenize_line(http_req_tokens *t, const char *p, const char *le) {
+	const char *q, *sp;
+
+	/* 方法名必须是token */
+	for (q = p; q < le && light_ctype_is(*q, LIGHT_CTYPE_TCHAR); q++);
+	if (q == p || q == le || *q != ' ') return -1;
+
+	t->method.ptr = p;
+	t->method.len = q - p;
+
+	p = q + 1;
+	sp = memchr(p, ' ', le - p);
+	if (sp == NULL || sp == p) return -1;
+
+	for (q = p; q < sp; q++) {
+		if (!light_ctype_is(*q, LIGHT_CTYPE_VCHAR)) return -1;
+	}
+
+	t->uri.ptr = p;
+	t->uri.len = sp - p;
+
+	/* 版本只接受"HTTP/x.y" */
+	p = sp + 1;
+	if (le - p != 8 ||
+	    0 != memcmp(p, "HTTP/", 5) ||
+	    !light_isdigit(p[5]) || p[6] != '.' || !light_isdigit(p[7])) {
+		return -1;
+	}
+
+	t->version.ptr = p;
+	t->version.len = 8;
+
+	return 0;
+}
+
+/**
+ * 切分一个头部，如"Host: example.org"
+ *
+ * value两端的空白(OWS)会被去掉。不支持以空白开头的
+ * 折行(obs-fold)，RFC 7230允许直接拒绝
+ *
+ * 先检查整行的格式再看数组是否还有空间，格式错误的行总是返回-1
+ *
+ * @param t 保存结果的对象
+ * @param p 行首
+ * @param le 行尾，不含"\r\n"
+ *
+ * @return 成功返回0，格式错误返回-1，头部个数超过hdrs_size返回-2
+ */
+static int http_request_tokenize_header(http_req_tokens *t, const char *p, const char *le) {
+	http_header_slice *h;
+	const char *q, *v, *c;
+
+	for (q = p; q < le && light_ctype_is(*q, LIGHT_CTYPE_TCHAR); q++);
+	if (q == p || q == le || *q != ':') return -1;
+
+	for (v = q + 1; v < le && (*v == ' ' || *v == '\t'); v++);
+	while (le > v && (le[-1] == ' ' || le[-1] == '\t')) le--;
+
+	for (c = v; c < le; c++) {
+		if (!light_ctype_is(*c, LIGHT_CTYPE_FIELD)) return -1;
+	}
+
+	if (t->hdrs_used == t->hdrs_size) return -2;
+
+	h = t->hdrs + t->hdrs_used;
+	h->key.ptr = p;
+	h->key.len = q - p;
+	h->value.ptr = v;
+	h->value.len = le - v;
+
+	t->hdrs_used++;
+
+	return 0;
+}
+
+/**
+ * 切分请求头
+ *
+ * 从s开始逐行切分出请求行和各个头部，直到遇到空行。
+ * 行尾可以是"\r\n"，也兼容单独的"\n"。请求行之前的空行
+ * 会被忽略。所有结果都指向s的内存，不做复制
+ *
+ * 整个请求头不能超过li_tunables.max_http_request_header
+ *
+ * @param t 保存结果的对象，hdrs和hdrs_size由调用者设置
+ * @param s 请求头的起始位置
+ * @param len 已经收到的长度
+ *
+ * @return 成功返回请求头的长度(包括最后的空行)，
+ *         数据还不完整返回0，格式错误返回-1(应答400)，
+ *         头部个数超过hdrs_size返回-2(可以换更大的数组重试，或应答431)
+ */
+int http_request_tokenize(http_req_tokens *t, const char *s, size_t len) {
+	const char *p = s, *end, *eol, *le;
+	int have_line = 0, r;
+
+	if (!t || !s) return -1;
+
+	t->hdrs_used = 0;
+
+	end = s + (len > li_tunables.max_http_request_header ? li_tunables.max_http_request_header : len);
+
+	while (NULL != (eol = http_find_eol(p, end))) {
+		le = eol;
+		if (le > p && le[-1] == '\r') le--;
+
+		if (le == p) {
+			/* 空行 */
+			if (have_line) return (eol + 1) - s;
+		} else if (!have_line) {
+			if (0 != http_request_tokenize_line(t, p, le)) return -1;
+			have_line = 1;
+		} else {
+			if (0 != (r = http_request_tokenize_header(t, p, le))) return r;
+		}
+
+		p = eol + 1;
+	}
+
+	/* 已经达到上限却还没有结束 */
+	if (len >= li_tunables.max_http_request_header) return -1;
+
+	return 0;
+}
+
+/**
+ * 对read_buffer中尚未处理的数据切分请求头
+ *
+ * 数据范围为[offset, used)，不会修改read_buffer
+ *
+ * @return 同http_request_tokenize
+ */
+int http_request_tokenize_read_buffer(http_req_tokens *t, read_buffer *rb) {
+	if (!rb || !rb->ptr || rb->used < rb->offset) return -1;
+
+	return http_request_tokenize(t, rb->ptr + rb->offset, rb->used - rb->offset);
+}
+
+/**
+ * 按名字查找头部，名字不区分大小写
+ *
+ * @return 找到返回value片段，否则返回NULL
+ */
+const http_slice *http_req_tokens_get(const http_req_tokens *t, const char *key, size_t key_len) {
+	size_t i;
+
+	for (i = 0; i < t->hdrs_used; i++) {
+		const http_header_slice *h = t->hdrs + i;
+
+		if (h->key.len == key_len &&
+		    0 == buffer_caseless_compare(h->key.ptr, h->key.len, key, key_len)) {
+			return &h->value;
+		}
+	}
+
+	return NULL;
+}
+
+/**
+ * 把切分的头部复制到buffer_array中
+ *
+ * 依次追加key和value两个buffer，只在真的需要可修改的
+ * 副本时才调用，平时直接使用片段即可
+ *
+ * @return 成功返回0，否则返回-1
+ */
+int http_req_tokens_to_array(const http_req_tokens *t, buffer_array *a) {
+	size_t i;
+
+	if (!t || !a) return -1;
+
+	for (i = 0; i < t->hdrs_used; i++) {
+		const http_header_slice *h = t->hdrs + i;
+
+		if (0 != buffer_copy_string_len(buffer_array_append_get_buffer(a), h->key.ptr, h->key.len)) return -1;
+		if (0 != buffer_copy_string_len(buffer_array_append_get_buffer(a), h->value.ptr, h->value.len)) return -1;
+	}
+
+	return 0;
+}
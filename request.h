@@ -0,0 +1,45 @@
+
+/**
+ * 请求头的切分
+ *
+ * 只在read_buffer原有的内存上做切分，得到的方法、uri、版本
+ * 以及各个头部的key/value都只是指向原内存的片段，不做任何复制
+ */
+
+#ifndef _REQUEST_H_
+#define _REQUEST_H_
+
+#include "buffer.h"
+
+/**
+ * 指向原内存的一个片段，不以'\0'结尾
+ */
+typedef struct {
+	const char *ptr;
+	size_t len;
+} http_slice;
+
+typedef struct {
+	http_slice key;
+	http_slice value;
+} http_header_slice;
+
+typedef struct {
+	http_slice method;
+	http_slice uri;
+	http_slice version;
+
+	http_header_slice *hdrs; /* 由调用者提供的数组 */
+	size_t hdrs_size;        /* 数组的大小 */
+	size_t hdrs_used;        /* 已切分出的头部个数 */
+} http_req_tokens;
+
+int http_request_header_end(read_buffer *rb);
+
+int http_request_tokenize(http_req_tokens *t, const char *s, size_t len);
+int http_request_tokenize_read_buffer(http_req_tokens *t, read_buffer *rb);
+
+const http_slice *http_req_tokens_get(const http_req_tokens *t, const char *key, size_t key_len);
+int http_req_tokens_to_array(const http_req_tokens *t, buffer_array *a);
+
+#endif
@@ -0,0 +1,230 @@
+
+/**
+ * 运行时可调整限制的登记表
+ *
+ * 每一项有名字、取值范围和默认值，默认值就是settings.h中的宏
+ */
+
+#include "settings.h"
+
+#include <string.h>
+
+/**
+ * 自动调整时各项的上限
+ */
+#define TUNABLES_ADAPTIVE_REUSE_MAX (64 * 1024)
+#define TUNABLES_ADAPTIVE_IO_MAX    (4 * 1024 * 1024)
+
+tunables li_tunables = {
+	BUFFER_MAX_REUSE_SIZE,
+	MAX_READ_LIMIT,
+	MAX_WRITE_LIMIT,
+	MAX_HTTP_REQUEST_HEADER,
+	0,
+	0
+};
+
+typedef struct {
+	const char *name;
+	size_t *value; /* NULL表示只读，其值为fixed */
+	long fixed;
+	long min;
+	long max;
+	unsigned int pin; /* 设置后在li_tunables.pinned中置位的标志，0表示不参与自动调整 */
+} tunable_entry;
+
+static const tunable_entry tunable_entries[] = {
+	{ "buffer_max_reuse_size",   &li_tunables.buffer_max_reuse_size,   0, 0, 16 * 1024 * 1024, TUNABLE_PIN_BUFFER_MAX_REUSE_SIZE },
+	{ "max_read_limit",          &li_tunables.max_read_limit,          0, 1024, 64 * 1024 * 1024, TUNABLE_PIN_MAX_READ_LIMIT },
+	{ "max_write_limit",         &li_tunables.max_write_limit,         0, 1024, 64 * 1024 * 1024, TUNABLE_PIN_MAX_WRITE_LIMIT },
+	{ "max_http_request_header", &li_tunables.max_http_request_header, 0, 1024, 1024 * 1024, 0 },
+	{ "inet_ntop_cache_max",     NULL, INET_NTOP_CACHE_MAX, 0, 0, 0 },
+	{ "file_cache_max",          NULL, FILE_CACHE_MAX, 0, 0, 0 },
+	{ NULL, NULL, 0, 0, 0, 0 }
+};
+
+/**
+ * 按名字查找登记项
+ *
+ * @return 找到返回登记项，否则返回NULL
+ */
+static const tunable_entry *tunables_find(const char *name) {
+	const tunable_entry *e;
+
+	if (!name) return NULL;
+
+	for (e = tunable_entries; e->name; e++) {
+		if (0 == strcmp(e->name, name)) return e;
+	}
+
+	return NULL;
+}
+
+/**
+ * 将所有限制恢复为编译时的默认值，清除设置过的标记，并关闭自动调整
+ */
+void tunables_reset(void) {
+	li_tunables.buffer_max_reuse_size = BUFFER_MAX_REUSE_SIZE;
+	li_tunables.max_read_limit = MAX_READ_LIMIT;
+	li_tunables.max_write_limit = MAX_WRITE_LIMIT;
+	li_tunables.max_http_request_header = MAX_HTTP_REQUEST_HEADER;
+	li_tunables.adaptive = 0;
+	li_tunables.pinned = 0;
+}
+
+/**
+ * 修改一项限制
+ *
+ * 除了登记表中的各项之外，"adaptive"用于打开或关闭自动调整。
+ * 设置过的项之后不再被自动调整，直到tunables_reset
+ *
+ * @param name 限制的名字，如"max_read_limit"
+ * @param value 新的值
+ *
+ * @return 成功返回0，名字不存在、只读或超出范围返回-1
+ */
+int tunables_set(const char *name, long value) {
+	const tunable_entry *e;
+
+	if (name && 0 == strcmp(name, "adaptive")) {
+		li_tunables.adaptive = (value != 0);
+		return 0;
+	}
+
+	if (NULL == (e = tunables_find(name))) return -1;
+	if (NULL == e->value) return -1;
+	if (value < e->min || value > e->max) return -1;
+
+	*(e->value) = value;
+	li_tunables.pinned |= e->pin;
+
+	return 0;
+}
+
+/**
+ * 读取一项限制的当前值
+ *
+ * @param name 限制的名字
+ * @param value 返回当前的值
+ *
+ * @return 成功返回0，名字不存在返回-1
+ */
+int tunables_get(const char *name, long *value) {
+	const tunable_entry *e;
+
+	if (!value) return -1;
+
+	if (name && 0 == strcmp(name, "adaptive")) {
+		*value = li_tunables.adaptive;
+		return 0;
+	}
+
+	if (NULL == (e = tunables_find(name))) return -1;
+
+	*value = e->value ? (long)*(e->value) : e->fixed;
+
+	return 0;
+}
+
+/**
+ * 观察buffer_reset时buffer的大小，调整buffer_max_reuse_size
+ *
+ * 用指数滑动平均(权重1/8)跟踪常见的大小，复用的上限取其
+ * 两倍，不低于默认值，也不超过TUNABLES_ADAPTIVE_REUSE_MAX。
+ * 这样常见大小的buffer都能被复用，偶尔的大buffer仍然被释放。
+ * 通过tunables_set设置过时不做调整
+ *
+ * @param size buffer的大小
+ */
+void tunables_observe_buffer(size_t size) {
+	static size_t avg = BUFFER_MAX_REUSE_SIZE / 2;
+	size_t limit;
+
+	if (!li_tunables.adaptive) return;
+	if (li_tunables.pinned & TUNABLE_PIN_BUFFER_MAX_REUSE_SIZE) return;
+
+	if (size > avg) {
+		avg += (size - avg) / 8;
+	} else {
+		avg -= (avg - size) / 8;
+	}
+
+	limit = avg * 2;
+	if (limit < BUFFER_MAX_REUSE_SIZE) limit = BUFFER_MAX_REUSE_SIZE;
+	if (limit > TUNABLES_ADAPTIVE_REUSE_MAX) limit = TUNABLES_ADAPTIVE_REUSE_MAX;
+
+	li_tunables.buffer_max_reuse_size = limit;
+}
+
+/**
+ * 读写上限的调整状态
+ */
+typedef struct {
+	unsigned int full;  /* 连续用满上限的次数 */
+	unsigned int small; /* 连续不到上限1/4的次数 */
+} tunables_io_state;
+
+/**
+ * 读和写各一份，和li_tunables一样只在主循环的线程中访问，
+ * 所以不加锁，见settings.h
+ */
+static tunables_io_state tunables_read_state;
+static tunables_io_state tunables_write_state;
+
+/**
+ * 根据一次读或写的字节数调整对应的上限
+ *
+ * 连续4次用满上限说明有大量数据，上限加倍，但不超过
+ * TUNABLES_ADAPTIVE_IO_MAX；连续64次都很少则减半，但不低于默认值
+ *
+ * @param st 调整状态
+ * @param limit 要调整的上限
+ * @param floor 上限的下界，即默认值
+ * @param len 这一次读或写的字节数
+ */
+static void tunables_observe_io(tunables_io_state *st, size_t *limit, size_t floor, size_t len) {
+	if (len >= *limit) {
+		st->small = 0;
+		if (++st->full >= 4) {
+			st->full = 0;
+			if (*limit < TUNABLES_ADAPTIVE_IO_MAX) {
+				*limit *= 2;
+				if (*limit > TUNABLES_ADAPTIVE_IO_MAX) *limit = TUNABLES_ADAPTIVE_IO_MAX;
+			}
+		}
+	} else if (len < *limit / 4) {
+		st->full = 0;
+		if (++st->small >= 64) {
+			st->small = 0;
+			*limit /= 2;
+			if (*limit < floor) *limit = floor;
+		}
+	} else {
+		st->full = 0;
+		st->small = 0;
+	}
+}
+
+/**
+ * 观察一次读操作读到的字节数，调整max_read_limit
+ *
+ * 由网络层在每次读成功之后调用，只能在主循环的线程中调用
+ */
+void tunables_observe_read(size_t len) {
+	if (!li_tunables.adaptive) return;
+	if (li_tunables.pinned & TUNABLE_PIN_MAX_READ_LIMIT) return;
+
+	tunables_observe_io(&tunables_read_state, &li_tunables.max_read_limit, MAX_READ_LIMIT, len);
+}
+
+/**
+ * 观察一次写操作写出的字节数，调整max_write_limit
+ *
+ * 由网络层在每次写成功之后调用，只能在主循环的线程中调用
+ */
+void tunables_observe_write(size_t len) {
+	if (!li_tunables.adaptive) return;
+	if (li_tunables.pinned & TUNABLE_PIN_MAX_WRITE_LIMIT) return;
+
+	tunables_observe_io(&tunables_write_state, &li_tunables.max_write_limit, MAX_WRITE_LIMIT, len);
+}
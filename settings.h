@@ -14,9 +14,17 @@
  */
 #define BV(x) (1 << x)
 
-#define INET_NTOP_CACHE_MAX 4
+#define INET_NTOP_CACHE_MAX 4096 /* 必须是INET_NTOP_CACHE_WAYS的倍数 */
 #define FILE_CACHE_MAX      16
 
+/**
+ * stat_cache的默认内存上限，内容读进内存的文件大小上限，
+ * 以及取不到RLIMIT_NOFILE时打开的fd个数上限
+ */
+#define STAT_CACHE_MEM_LIMIT   (64 * 1024 * 1024)
+#define STAT_CACHE_CONTENT_MAX (64 * 1024)
+#define STAT_CACHE_FD_MAX      4096
+
 /**
  * max size of a buffer which will just be reset
  * to ->used = 0 instead of really freeing the buffer
@@ -48,6 +56,57 @@ typedef enum { HANDLER_UNSET,
 
 #define HTTP_LINGER_TIMEOUT 5
 
+#include <stddef.h>
+
+/**
+ * 运行时可以调整的限制
+ *
+ * 上面的宏只作为默认值，启动时或运行中可以通过tunables_set
+ * 修改，热路径上直接读li_tunables的成员，没有额外开销。
+ *
+ * 成员都是普通的size_t，没有加锁也不是原子变量:tunables_set、
+ * tunables_reset和tunables_observe_*只能在主循环所在的线程中调用
+ * (网络读写本来就都在这个线程)。别的线程，如file_pool的工作线程，
+ * 只能读，可能读到稍旧的值，所以这些值只能当作软限制使用，
+ * 不能用来决定数组的大小
+ *
+ * INET_NTOP_CACHE_MAX和FILE_CACHE_MAX决定的是静态数组的大小，
+ * 只能在编译时确定，在登记表中是只读的
+ */
+typedef struct {
+	size_t buffer_max_reuse_size;
+	size_t max_read_limit;
+	size_t max_write_limit;
+	size_t max_http_request_header;
+
+	/**
+	 * 为1时根据观察到的流量自动调整buffer_max_reuse_size
+	 * 以及读写的上限，见tunables_observe_*。
+	 * 编译时打开BUFFER_THREAD_CACHE时不调整buffer_max_reuse_size
+	 */
+	int adaptive;
+
+	/**
+	 * 通过tunables_set明确设置过的项，自动调整跳过这些项，
+	 * 不会覆盖管理员设置的值
+	 */
+	unsigned int pinned;
+} tunables;
+
+#define TUNABLE_PIN_BUFFER_MAX_REUSE_SIZE (1u << 0)
+#define TUNABLE_PIN_MAX_READ_LIMIT        (1u << 1)
+#define TUNABLE_PIN_MAX_WRITE_LIMIT       (1u << 2)
+
+extern tunables li_tunables;
+
+void tunables_reset(void);
+int tunables_set(const char *name, long value);
+int tunables_get(const char *name, long *value);
+
+void tunables_observe_buffer(size_t size);
+void tunables_observe_read(size_t len);
+void tunables_observe_write(size_t len);
+
 /* we use it in a enum */
 /* 
  * 清除对布尔值TRUE,FALSE的定义
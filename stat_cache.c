@@ -0,0 +1,666 @@
+
+/**
+ * 记住一条:stat_cache_get_entry返回的指针只在下一次调用
+ * stat_cache的函数之前有效，之后这一项可能已被淘汰或刷新
+ *
+ * 缓存的key是调用者给出的路径，不做规范化，调用者应给出
+ * 绝对路径并先用buffer_path_simplify处理，否则同一个文件会有
+ * 多项，inotify的通知也对不上
+ */
+
+#include "stat_cache.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+#ifdef __linux__
+# include <sys/inotify.h>
+# define STAT_CACHE_USE_INOTIFY
+#endif
+
+#define STAT_CACHE_INIT_SIZE     1024 /* 散列桶初始的个数 */
+#define STAT_CACHE_WATCH_BUCKETS 1024
+
+/**
+ * 一项的内存占用，包括读进内存的内容
+ */
+static size_t stat_cache_entry_mem(stat_cache_entry *e) {
+	size_t mem = sizeof(*e);
+
+	mem += e->name->size + e->etag->size;
+	mem += e->last_modified->size + e->content_type->size;
+	if (e->content) mem += e->st.st_size;
+
+	return mem;
+}
+
+/**
+ * 重新计算一项的内存占用，同时更新总数
+ */
+static void stat_cache_entry_account(stat_cache *sc, stat_cache_entry *e) {
+	sc->mem_used -= e->mem;
+	e->mem = stat_cache_entry_mem(e);
+	sc->mem_used += e->mem;
+}
+
+/**
+ * 根据stat的结果生成ETag和Last-Modified
+ *
+ * ETag为"inode-size-mtime"，都用16进制
+ */
+static void stat_cache_entry_headers(stat_cache_entry *e) {
+	buffer_copy_string_len(e->etag, CONST_STR_LEN("\""));
+	buffer_append_long_hex(e->etag, (unsigned long)e->st.st_ino);
+	buffer_append_string_len(e->etag, CONST_STR_LEN("-"));
+	buffer_append_long_hex(e->etag, (unsigned long)e->st.st_size);
+	buffer_append_string_len(e->etag, CONST_STR_LEN("-"));
+	buffer_append_long_hex(e->etag, (unsigned long)e->st.st_mtime);
+	buffer_append_string_len(e->etag, CONST_STR_LEN("\""));
+
+	buffer_copy_string_len(e->last_modified, CONST_STR_LEN(""));
+	buffer_append_mtime(e->last_modified, e->st.st_mtime);
+}
+
+/**
+ * 关闭fd，释放读进来的内容
+ */
+static void stat_cache_entry_release(stat_cache *sc, stat_cache_entry *e) {
+	if (e->content) {
+		free(e->content);
+		e->content = NULL;
+	}
+	if (e->fd != -1) {
+		close(e->fd);
+		e->fd = -1;
+		sc->fd_used--;
+	}
+}
+
+/**
+ * 文件是否变化了
+ */
+static int stat_cache_st_changed(const struct stat *a, const struct stat *b) {
+	return a->st_ino != b->st_ino ||
+	       a->st_dev != b->st_dev ||
+	       a->st_size != b->st_size ||
+	       a->st_mtime != b->st_mtime ||
+	       a->st_ctime != b->st_ctime;
+}
+
+/**
+ * 把文件的内容读进内存
+ *
+ * 不用mmap:文件被截短后访问映射中超出的部分会收到SIGBUS，
+ * 而缓存项可能在文件变化之后还被使用一段时间。小文件复制一份
+ * 代价很小，读到的长度和st_size不同说明文件正在变化，不缓存内容
+ *
+ * @return 成功返回内容，失败返回NULL
+ */
+static char *stat_cache_read_content(int fd, size_t size) {
+	char *p, c;
+	size_t off = 0;
+	ssize_t r;
+
+	p = malloc(size);
+	assert(p);
+
+	while (off < size) {
+		r = pread(fd, p + off, size - off, off);
+		if (r == -1 && errno == EINTR) continue;
+		if (r <= 0) break;
+		off += r;
+	}
+
+	/* 再多读一个字节，文件变长了也不能用 */
+	if (off != size || 0 != pread(fd, &c, 1, off)) {
+		free(p);
+		return NULL;
+	}
+
+	return p;
+}
+
+/**
+ * 按flags打开fd和读入内容
+ *
+ * 打开之后再fstat一次，文件在stat和open之间被替换时以fstat为准
+ *
+ * @return 成功返回0，打开失败返回-1
+ */
+static int stat_cache_entry_open(stat_cache *sc, stat_cache_entry *e, int flags) {
+	struct stat st;
+	int fd = e->fd;
+
+	if (!S_ISREG(e->st.st_mode)) return 0;
+
+	if (flags & STAT_CACHE_CONTENT) {
+		if (e->content || e->st.st_size == 0 || (size_t)e->st.st_size > sc->content_max) {
+			flags &= ~STAT_CACHE_CONTENT;
+		}
+	}
+	if (!(flags & STAT_CACHE_CONTENT) && (!(flags & STAT_CACHE_OPEN_FD) || e->fd != -1)) return 0;
+
+	if (fd == -1) {
+		if (-1 == (fd = open(e->name->ptr, O_RDONLY | O_NOCTTY))) return -1;
+#ifdef FD_CLOEXEC
+		fcntl(fd, F_SETFD, FD_CLOEXEC);
+#endif
+		if (-1 == fstat(fd, &st)) {
+			close(fd);
+			return -1;
+		}
+		if (stat_cache_st_changed(&st, &e->st)) {
+			stat_cache_entry_release(sc, e);
+			e->st = st;
+			stat_cache_entry_headers(e);
+		}
+	}
+
+	if ((flags & STAT_CACHE_CONTENT) && e->st.st_size > 0 &&
+	    (size_t)e->st.st_size <= sc->content_max) {
+		e->content = stat_cache_read_content(fd, e->st.st_size);
+	}
+
+	if (flags & STAT_CACHE_OPEN_FD) {
+		if (e->fd == -1) sc->fd_used++;
+		e->fd = fd;
+	} else if (fd != e->fd) {
+		close(fd);
+	}
+
+	stat_cache_entry_account(sc, e);
+
+	return 0;
+}
+
+static void stat_cache_lru_unlink(stat_cache *sc, stat_cache_entry *e) {
+	if (e->lru_prev) {
+		e->lru_prev->lru_next = e->lru_next;
+	} else {
+		sc->lru_head = e->lru_next;
+	}
+	if (e->lru_next) {
+		e->lru_next->lru_prev = e->lru_prev;
+	} else {
+		sc->lru_tail = e->lru_prev;
+	}
+	e->lru_prev = e->lru_next = NULL;
+}
+
+static void stat_cache_lru_push(stat_cache *sc, stat_cache_entry *e) {
+	e->lru_prev = NULL;
+	e->lru_next = sc->lru_head;
+	if (sc->lru_head) {
+		sc->lru_head->lru_prev = e;
+	} else {
+		sc->lru_tail = e;
+	}
+	sc->lru_head = e;
+}
+
+/**
+ * 按wd查找watch
+ */
+static stat_cache_watch *stat_cache_watch_find(stat_cache *sc, int wd) {
+	stat_cache_watch *w;
+
+	for (w = sc->watches[(unsigned int)wd % STAT_CACHE_WATCH_BUCKETS]; w; w = w->next) {
+		if (w->wd == wd) return w;
+	}
+
+	return NULL;
+}
+
+/**
+ * 为文件所在的目录加上inotify watch
+ *
+ * 同一个目录只有一个watch，用引用计数记录有多少项在用。
+ * 经过符号链接或bind mount，不同的路径可能是同一个目录，
+ * inotify返回相同的wd，所以每个watch记下用过的所有路径，
+ * 事件到来时在每个路径下查找
+ *
+ * @return 成功返回wd，没有inotify或失败返回-1
+ */
+static int stat_cache_watch_add(stat_cache *sc, buffer *name) {
+#ifdef STAT_CACHE_USE_INOTIFY
+	stat_cache_watch *w, **bucket;
+	const char *slash;
+	size_t i;
+	int wd;
+
+	if (sc->inotify_fd == -1) return -1;
+
+	slash = strrchr(name->ptr, '/');
+	if (slash == NULL) {
+		buffer_copy_string_len(sc->tmp, CONST_STR_LEN("."));
+	} else if (slash == name->ptr) {
+		buffer_copy_string_len(sc->tmp, CONST_STR_LEN("/"));
+	} else {
+		buffer_copy_string_len(sc->tmp, name->ptr, slash - name->ptr);
+	}
+
+	wd = inotify_add_watch(sc->inotify_fd, sc->tmp->ptr,
+		IN_ATTRIB | IN_MODIFY | IN_CLOSE_WRITE | IN_CREATE |
+		IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO |
+		IN_DELETE_SELF | IN_MOVE_SELF);
+	if (wd == -1) return -1;
+
+	if (NULL != (w = stat_cache_watch_find(sc, wd))) {
+		w->refs++;
+
+		for (i = 0; i < w->dirs->used; i++) {
+			if (buffer_is_equal(w->dirs->ptr[i], sc->tmp)) return wd;
+		}
+		buffer_copy_string_buffer(buffer_array_append_get_buffer(w->dirs), sc->tmp);
+
+		return wd;
+	}
+
+	w = calloc(1, sizeof(*w));
+	assert(w);
+	w->wd = wd;
+	w->refs = 1;
+	w->dirs = buffer_array_init();
+	buffer_copy_string_buffer(buffer_array_append_get_buffer(w->dirs), sc->tmp);
+
+	bucket = &sc->watches[(unsigned int)wd % STAT_CACHE_WATCH_BUCKETS];
+	w->next = *bucket;
+	*bucket = w;
+
+	return wd;
+#else
+	UNUSED(sc);
+	UNUSED(name);
+	return -1;
+#endif
+}
+
+/**
+ * 去掉一个引用，没有引用时删除watch
+ *
+ * @param rm 是否调用inotify_rm_watch，目录已被删除时内核已经去掉了watch
+ */
+static void stat_cache_watch_release(stat_cache *sc, int wd, int rm) {
+	stat_cache_watch *w, **pw;
+
+	if (wd == -1) return;
+
+	for (pw = &sc->watches[(unsigned int)wd % STAT_CACHE_WATCH_BUCKETS]; (w = *pw); pw = &w->next) {
+		if (w->wd != wd) continue;
+		if (--w->refs > 0) return;
+
+		*pw = w->next;
+#ifdef STAT_CACHE_USE_INOTIFY
+		if (rm) inotify_rm_watch(sc->inotify_fd, wd);
+#else
+		UNUSED(rm);
+#endif
+		buffer_array_free(w->dirs);
+		free(w);
+		return;
+	}
+}
+
+/**
+ * 散列表中name所在的位置
+ *
+ * @return 指向链上指针的指针，没有找到时*返回值为NULL
+ */
+static stat_cache_entry **stat_cache_lookup(stat_cache *sc, buffer *name, uint64_t hash) {
+	stat_cache_entry **pe;
+
+	for (pe = &sc->ptr[hash & (sc->size - 1)]; *pe; pe = &(*pe)->hnext) {
+		if ((*pe)->hash == hash && buffer_is_equal((*pe)->name, name)) break;
+	}
+
+	return pe;
+}
+
+/**
+ * 删除一项
+ */
+static void stat_cache_remove(stat_cache *sc, stat_cache_entry *e, int rm_watch) {
+	stat_cache_entry **pe;
+
+	for (pe = &sc->ptr[e->hash & (sc->size - 1)]; *pe; pe = &(*pe)->hnext) {
+		if (*pe == e) {
+			*pe = e->hnext;
+			break;
+		}
+	}
+	stat_cache_lru_unlink(sc, e);
+
+	stat_cache_watch_release(sc, e->wd, rm_watch);
+	stat_cache_entry_release(sc, e);
+
+	sc->mem_used -= e->mem;
+	sc->used--;
+
+	buffer_free(e->name);
+	buffer_free(e->etag);
+	buffer_free(e->last_modified);
+	buffer_free(e->content_type);
+	free(e);
+}
+
+/**
+ * 散列表扩大一倍
+ */
+static void stat_cache_grow(stat_cache *sc) {
+	stat_cache_entry **ptr, *e, *next;
+	size_t i, size = sc->size * 2;
+
+	ptr = calloc(size, sizeof(*ptr));
+	assert(ptr);
+
+	for (i = 0; i < sc->size; i++) {
+		for (e = sc->ptr[i]; e; e = next) {
+			next = e->hnext;
+			e->hnext = ptr[e->hash & (size - 1)];
+			ptr[e->hash & (size - 1)] = e;
+		}
+	}
+
+	free(sc->ptr);
+	sc->ptr = ptr;
+	sc->size = size;
+}
+
+/**
+ * 从LRU链表的尾部淘汰，直到内存占用和打开的fd个数都不超过上限
+ *
+ * @param keep 不能淘汰的一项，即刚刚取出的
+ */
+static void stat_cache_evict(stat_cache *sc, stat_cache_entry *keep) {
+	while ((sc->mem_used > sc->mem_limit || sc->fd_used > sc->fd_max) &&
+	       sc->lru_tail && sc->lru_tail != keep) {
+		stat_cache_remove(sc, sc->lru_tail, 1);
+	}
+}
+
+/**
+ * 默认的fd个数上限
+ *
+ * 取RLIMIT_NOFILE的1/4，其余留给连接和后端。
+ * 没有限制或取不到时用STAT_CACHE_FD_MAX
+ */
+static size_t stat_cache_default_fd_max(void) {
+	struct rlimit rl;
+
+	if (0 != getrlimit(RLIMIT_NOFILE, &rl) || rl.rlim_cur == RLIM_INFINITY) {
+		return STAT_CACHE_FD_MAX;
+	}
+
+	return rl.rlim_cur / 4 ? rl.rlim_cur / 4 : 1;
+}
+
+/**
+ * 初始化缓存
+ *
+ * 系统不支持inotify或inotify_init失败时仍然可以用，
+ * 只是每次取缓存项都要重新stat来验证
+ *
+ * @param mem_limit 内存的上限，0时取STAT_CACHE_MEM_LIMIT
+ * @param content_max 不超过这个大小的文件才读进内存，0时取STAT_CACHE_CONTENT_MAX
+ * @param fd_max 缓存中打开的fd个数上限，0时按RLIMIT_NOFILE计算
+ */
+stat_cache *stat_cache_init(size_t mem_limit, size_t content_max, size_t fd_max) {
+	stat_cache *sc;
+
+	sc = calloc(1, sizeof(*sc));
+	assert(sc);
+
+	sc->size = STAT_CACHE_INIT_SIZE;
+	sc->ptr = calloc(sc->size, sizeof(*sc->ptr));
+	assert(sc->ptr);
+	sc->watches = calloc(STAT_CACHE_WATCH_BUCKETS, sizeof(*sc->watches));
+	assert(sc->watches);
+
+	sc->mem_limit = mem_limit ? mem_limit : STAT_CACHE_MEM_LIMIT;
+	sc->content_max = content_max ? content_max : STAT_CACHE_CONTENT_MAX;
+	sc->fd_max = fd_max ? fd_max : stat_cache_default_fd_max();
+	sc->tmp = buffer_init();
+
+#ifdef STAT_CACHE_USE_INOTIFY
+	sc->inotify_fd = inotify_init();
+	if (sc->inotify_fd != -1) {
+		fcntl(sc->inotify_fd, F_SETFL, fcntl(sc->inotify_fd, F_GETFL) | O_NONBLOCK);
+		fcntl(sc->inotify_fd, F_SETFD, FD_CLOEXEC);
+	}
+#else
+	sc->inotify_fd = -1;
+#endif
+
+	return sc;
+}
+
+void stat_cache_free(stat_cache *sc) {
+	size_t i;
+
+	if (!sc) return;
+
+	/* 关闭inotify_fd时所有watch都被去掉，不必逐个删除 */
+	if (sc->inotify_fd != -1) close(sc->inotify_fd);
+	sc->inotify_fd = -1;
+
+	while (sc->lru_head) stat_cache_remove(sc, sc->lru_head, 0);
+
+	for (i = 0; i < STAT_CACHE_WATCH_BUCKETS; i++) {
+		assert(sc->watches[i] == NULL);
+	}
+
+	free(sc->watches);
+	free(sc->ptr);
+	buffer_free(sc->tmp);
+	free(sc);
+}
+
+/**
+ * 取一个文件的缓存项
+ *
+ * 没有缓存时stat并加入缓存。有inotify时直接使用缓存中的结果，
+ * 否则重新stat，文件变化了就刷新这一项
+ *
+ * @param sc 缓存
+ * @param name 文件的路径
+ * @param flags STAT_CACHE_OPEN_FD需要打开的fd，STAT_CACHE_CONTENT需要
+ *        小文件的内容(不保证成功，调用者要检查content)
+ *
+ * @return 成功返回缓存项，stat或open失败返回NULL，errno为失败的原因
+ */
+stat_cache_entry *stat_cache_get_entry(stat_cache *sc, buffer *name, int flags) {
+	stat_cache_entry *e, **pe;
+	struct stat st;
+	uint64_t hash;
+
+	if (!sc || buffer_is_empty(name)) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	hash = buffer_hash(name);
+	pe = stat_cache_lookup(sc, name, hash);
+
+	if (NULL != (e = *pe)) {
+		if (sc->inotify_fd == -1 || e->wd == -1) {
+			if (-1 == stat(name->ptr, &st)) {
+				stat_cache_remove(sc, e, 1);
+				return NULL;
+			}
+			if (stat_cache_st_changed(&st, &e->st)) {
+				stat_cache_entry_release(sc, e);
+				e->st = st;
+				stat_cache_entry_headers(e);
+				stat_cache_entry_account(sc, e);
+			}
+		}
+
+		sc->hits++;
+		stat_cache_lru_unlink(sc, e);
+		stat_cache_lru_push(sc, e);
+	} else {
+		sc->misses++;
+
+		if (-1 == stat(name->ptr, &st)) return NULL;
+
+		e = calloc(1, sizeof(*e));
+		assert(e);
+
+		e->name = buffer_init_buffer(name);
+		e->hash = hash;
+		e->st = st;
+		e->fd = -1;
+		e->etag = buffer_init();
+		e->last_modified = buffer_init();
+		e->content_type = buffer_init();
+		e->wd = stat_cache_watch_add(sc, name);
+
+		/* watch加上之前文件可能变了，再stat一次 */
+		if (e->wd != -1 && 0 == stat(name->ptr, &st)) e->st = st;
+		stat_cache_entry_headers(e);
+
+		e->hnext = *pe;
+		*pe = e;
+		stat_cache_lru_push(sc, e);
+		sc->used++;
+		stat_cache_entry_account(sc, e);
+
+		if (sc->used > sc->size * 2) stat_cache_grow(sc);
+	}
+
+	if (flags && -1 == stat_cache_entry_open(sc, e, flags)) {
+		int err = errno;
+		stat_cache_remove(sc, e, 1);
+		errno = err;
+		return NULL;
+	}
+
+	stat_cache_evict(sc, e);
+
+	return e;
+}
+
+/**
+ * 删除一个文件的缓存项，下次访问时重新stat
+ */
+void stat_cache_invalidate(stat_cache *sc, buffer *name) {
+	stat_cache_entry *e;
+
+	if (!sc || buffer_is_empty(name)) return;
+
+	if (NULL != (e = *stat_cache_lookup(sc, name, buffer_hash(name)))) {
+		stat_cache_remove(sc, e, 1);
+	}
+}
+
+/**
+ * 删除所有缓存项
+ */
+void stat_cache_flush(stat_cache *sc) {
+	if (!sc) return;
+
+	while (sc->lru_head) stat_cache_remove(sc, sc->lru_head, 1);
+}
+
+/**
+ * 删除一个目录下的所有缓存项，目录本身被删除或移走时使用
+ *
+ * 需要遍历所有项，不过这种事件很少
+ */
+static void stat_cache_invalidate_wd(stat_cache *sc, int wd, int rm_watch) {
+	stat_cache_entry *e, *next;
+
+	for (e = sc->lru_head; e; e = next) {
+		next = e->lru_next;
+		if (e->wd == wd) stat_cache_remove(sc, e, rm_watch);
+	}
+}
+
+/**
+ * inotify的fd，调用者把它加到事件循环中，可读时调用
+ * stat_cache_handle_events
+ *
+ * @return 没有inotify时返回-1
+ */
+int stat_cache_get_fd(stat_cache *sc) {
+	return sc ? sc->inotify_fd : -1;
+}
+
+/**
+ * 读取inotify的事件，删除变化了的缓存项
+ *
+ * 事件队列溢出时无法知道哪些文件变了，清空整个缓存
+ *
+ * @return 处理的事件数，出错返回-1
+ */
+int stat_cache_handle_events(stat_cache *sc) {
+#ifdef STAT_CACHE_USE_INOTIFY
+	char buf[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+	const struct inotify_event *ev;
+	stat_cache_watch *w;
+	stat_cache_entry *e;
+	ssize_t r;
+	size_t i;
+	char *p;
+	int n = 0, last;
+
+	if (!sc || sc->inotify_fd == -1) return -1;
+
+	for (;;) {
+		r = read(sc->inotify_fd, buf, sizeof(buf));
+		if (r == -1) {
+			if (errno == EINTR) continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+			return -1;
+		}
+		if (r == 0) break;
+
+		for (p = buf; p < buf + r; p += sizeof(*ev) + ev->len) {
+			ev = (const struct inotify_event *)p;
+			n++;
+
+			if (ev->mask & IN_Q_OVERFLOW) {
+				stat_cache_flush(sc);
+				continue;
+			}
+
+			if (NULL == (w = stat_cache_watch_find(sc, ev->wd))) continue;
+
+			if (ev->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED)) {
+				/* 最后一项删除时watch也被释放，w不能再用 */
+				stat_cache_invalidate_wd(sc, ev->wd, !(ev->mask & IN_IGNORED));
+				continue;
+			}
+
+			if (ev->len == 0) continue;
+
+			/* 同一个目录经不同路径缓存的项都要删除 */
+			for (i = 0; i < w->dirs->used; i++) {
+				buffer_copy_string_buffer(sc->tmp, w->dirs->ptr[i]);
+				if (sc->tmp->ptr[sc->tmp->used - 2] != '/') {
+					buffer_append_string_len(sc->tmp, CONST_STR_LEN("/"));
+				}
+				buffer_append_string(sc->tmp, ev->name);
+
+				e = *stat_cache_lookup(sc, sc->tmp, buffer_hash(sc->tmp));
+				if (e == NULL || e->wd != ev->wd) continue;
+
+				/* 最后一项删除时watch也被释放，w不能再用 */
+				last = (w->refs == 1);
+				stat_cache_remove(sc, e, 1);
+				if (last) break;
+			}
+		}
+	}
+
+	return n;
+#else
+	UNUSED(sc);
+	return -1;
+#endif
+}
@@ -0,0 +1,87 @@
+
+/**
+ * 静态文件的stat/fd/内容缓存
+ *
+ * 缓存stat的结果、打开的fd、预先生成的ETag和Last-Modified，
+ * 小文件还可以把内容读进内存。文件的变化通过inotify得知，
+ * 不用每次请求都重新stat。总的内存占用和打开的fd个数都有上限，
+ * 超过时按LRU淘汰
+ */
+
+#ifndef _STAT_CACHE_H_
+#define _STAT_CACHE_H_
+
+#include "buffer.h"
+#include "settings.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+/**
+ * stat_cache_get_entry的flags
+ */
+#define STAT_CACHE_OPEN_FD 0x01 /* 需要打开的fd */
+#define STAT_CACHE_CONTENT 0x02 /* 小文件需要读进内存的内容 */
+
+typedef struct stat_cache_entry {
+	buffer *name;           /* 路径，即散列的key */
+	uint64_t hash;
+
+	struct stat st;
+	int fd;                 /* 打开的fd，-1表示没有打开 */
+	char *content;          /* 读进内存的内容，长度为st.st_size，NULL表示没有 */
+
+	buffer *etag;
+	buffer *last_modified;
+	buffer *content_type;   /* 由调用者根据扩展名填写，文件变化时保留 */
+
+	int wd;                 /* 所在目录的inotify watch，-1表示没有 */
+	size_t mem;             /* 这一项占用的内存 */
+
+	struct stat_cache_entry *hnext;    /* 散列链 */
+	struct stat_cache_entry *lru_prev; /* LRU链表，头部是最近用过的 */
+	struct stat_cache_entry *lru_next;
+} stat_cache_entry;
+
+typedef struct stat_cache_watch {
+	int wd;
+	size_t refs;            /* 引用这个目录的缓存项个数 */
+	buffer_array *dirs;     /* 这个目录的所有路径，符号链接或bind mount时不止一个 */
+	struct stat_cache_watch *next;
+} stat_cache_watch;
+
+typedef struct {
+	stat_cache_entry **ptr; /* 散列表 */
+	size_t size;            /* 散列桶的个数，总是2的幂 */
+	size_t used;            /* 缓存项的个数 */
+
+	stat_cache_entry *lru_head;
+	stat_cache_entry *lru_tail;
+
+	size_t mem_used;
+	size_t mem_limit;       /* 内存的上限 */
+	size_t content_max;     /* 不超过这个大小的文件才读进内存 */
+
+	size_t fd_used;         /* 缓存项中打开的fd个数 */
+	size_t fd_max;          /* fd个数的上限 */
+
+	int inotify_fd;         /* -1表示没有inotify，每次都重新stat */
+	stat_cache_watch **watches;
+
+	buffer *tmp;
+
+	uint64_t hits;
+	uint64_t misses;
+} stat_cache;
+
+stat_cache *stat_cache_init(size_t mem_limit, size_t content_max, size_t fd_max);
+void stat_cache_free(stat_cache *sc);
+
+stat_cache_entry *stat_cache_get_entry(stat_cache *sc, buffer *name, int flags);
+void stat_cache_invalidate(stat_cache *sc, buffer *name);
+void stat_cache_flush(stat_cache *sc);
+
+int stat_cache_get_fd(stat_cache *sc);
+int stat_cache_handle_events(stat_cache *sc);
+
+#endif
@@ -0,0 +1,240 @@
+
+/**
+ * 记住一条:先把上层的格子下放，再处理第0层的格子，
+ * 这样下放到当前格的定时器在同一个tick内到期
+ *
+ * 典型的用法，tick为一秒:
+ *
+ *	static handler_t connection_timeout(timer_wheel *w, timer_node *t, void *ctx) {
+ *		connection *con = ctx;
+ *		... 把con的状态设为CON_STATE_ERROR，关闭连接 ...
+ *		return HANDLER_FINISHED;
+ *	}
+ *
+ *	timer_node_init(&con->timer, connection_timeout, con);
+ *	timer_wheel_arm(&srv->timers, &con->timer, con->conf.max_keep_alive_idle);
+ *	... 连接有读写时重新timer_wheel_arm，关闭时timer_wheel_cancel ...
+ *	timer_wheel_advance(&srv->timers, srv->cur_ts);
+ */
+
+#include "timer_wheel.h"
+
+#include <string.h>
+
+static void timer_link_init(timer_link *l) {
+	l->prev = l->next = l;
+}
+
+static int timer_link_empty(timer_link *l) {
+	return l->next == l;
+}
+
+static void timer_link_add(timer_link *head, timer_link *l) {
+	l->prev = head->prev;
+	l->next = head;
+	head->prev->next = l;
+	head->prev = l;
+}
+
+static void timer_link_del(timer_link *l) {
+	l->prev->next = l->next;
+	l->next->prev = l->prev;
+	l->prev = l->next = l;
+}
+
+/**
+ * 把src中的所有定时器移到dst，src变为空
+ */
+static void timer_link_move(timer_link *dst, timer_link *src) {
+	timer_link_init(dst);
+	if (timer_link_empty(src)) return;
+
+	dst->next = src->next;
+	dst->prev = src->prev;
+	dst->next->prev = dst;
+	dst->prev->next = dst;
+	timer_link_init(src);
+}
+
+/**
+ * 按到期时间把定时器放到对应层的格子中
+ *
+ * 剩余时间小于一圈放在第0层，小于两层的一圈放在第1层，依此类推
+ */
+static void timer_wheel_place(timer_wheel *w, timer_node *t) {
+	uint64_t delta = t->expires - w->now;
+	int level;
+
+	for (level = 0; level < TIMER_WHEEL_LEVELS - 1; level++) {
+		if (delta < ((uint64_t)1 << (TIMER_WHEEL_BITS * (level + 1)))) break;
+	}
+
+	timer_link_add(&w->slots[level][(t->expires >> (TIMER_WHEEL_BITS * level)) & TIMER_WHEEL_MASK], &t->link);
+}
+
+/**
+ * 初始化时间轮
+ *
+ * @param w 时间轮
+ * @param now 当前的tick，如srv->cur_ts
+ */
+void timer_wheel_init(timer_wheel *w, uint64_t now) {
+	int i, j;
+
+	memset(w, 0, sizeof(*w));
+	for (i = 0; i < TIMER_WHEEL_LEVELS; i++) {
+		for (j = 0; j < TIMER_WHEEL_SLOTS; j++) {
+			timer_link_init(&w->slots[i][j]);
+		}
+	}
+	w->now = now;
+}
+
+/**
+ * 初始化定时器，一般在建立连接时调用一次
+ */
+void timer_node_init(timer_node *t, timer_cb cb, void *ctx) {
+	memset(t, 0, sizeof(*t));
+	timer_link_init(&t->link);
+	t->cb = cb;
+	t->ctx = ctx;
+}
+
+/**
+ * 加入定时器
+ *
+ * 已经加入的定时器先取消，所以连接每次活动后直接重新加入即可
+ *
+ * @param w 时间轮
+ * @param t 定时器
+ * @param timeout 多少个tick之后到期，0当作1，
+ *        超过TIMER_WHEEL_MAX_TIMEOUT当作TIMER_WHEEL_MAX_TIMEOUT
+ */
+void timer_wheel_arm(timer_wheel *w, timer_node *t, uint64_t timeout) {
+	if (t->armed) {
+		timer_link_del(&t->link);
+	} else {
+		t->armed = 1;
+		w->used++;
+	}
+
+	if (timeout == 0) timeout = 1;
+	if (timeout > TIMER_WHEEL_MAX_TIMEOUT) timeout = TIMER_WHEEL_MAX_TIMEOUT;
+
+	t->timeout = timeout;
+	t->expires = w->now + timeout;
+	timer_wheel_place(w, t);
+}
+
+/**
+ * 取消定时器，没有加入的定时器不受影响
+ */
+void timer_wheel_cancel(timer_wheel *w, timer_node *t) {
+	if (!t->armed) return;
+
+	timer_link_del(&t->link);
+	t->armed = 0;
+	w->used--;
+}
+
+/**
+ * 把第level层当前的格子下放
+ */
+static void timer_wheel_cascade(timer_wheel *w, int level) {
+	timer_link list, *l;
+
+	timer_link_move(&list, &w->slots[level][(w->now >> (TIMER_WHEEL_BITS * level)) & TIMER_WHEEL_MASK]);
+
+	while (!timer_link_empty(&list)) {
+		l = list.next;
+		timer_link_del(l);
+		timer_wheel_place(w, (timer_node *)l);
+	}
+}
+
+/**
+ * 推进到now，调用所有到期定时器的回调
+ *
+ * 每个tick的到期定时器先移到一个临时链表中再逐个处理，
+ * 回调中取消其它定时器(包括临时链表中的)也是安全的
+ *
+ * @param w 时间轮
+ * @param now 当前的tick，比上次小时什么都不做
+ *
+ * @return 到期的定时器个数
+ */
+size_t timer_wheel_advance(timer_wheel *w, uint64_t now) {
+	timer_link list, *l;
+	timer_node *t;
+	size_t n = 0;
+	int level;
+
+	while (w->now < now) {
+		/* 没有定时器时直接跳过，长时间空闲后不用逐个tick处理 */
+		if (w->used == 0) {
+			w->now = now;
+			break;
+		}
+
+		w->now++;
+
+		for (level = 1; level < TIMER_WHEEL_LEVELS; level++) {
+			if ((w->now >> (TIMER_WHEEL_BITS * (level - 1))) & TIMER_WHEEL_MASK) break;
+		}
+		while (--level > 0) timer_wheel_cascade(w, level);
+
+		timer_link_move(&list, &w->slots[0][w->now & TIMER_WHEEL_MASK]);
+
+		while (!timer_link_empty(&list)) {
+			l = list.next;
+			t = (timer_node *)l;
+
+			timer_link_del(l);
+			t->armed = 0;
+			w->used--;
+			w->fired++;
+			n++;
+
+			if (HANDLER_COMEBACK == t->cb(w, t, t->ctx) && !t->armed) {
+				timer_wheel_arm(w, t, t->timeout);
+			}
+		}
+	}
+
+	return n;
+}
+
+/**
+ * 距离下一个定时器到期还有多少个tick，用来决定事件循环
+ * 最多等待多久
+ *
+ * 第0层是精确的，上层的格子只能给出下限，不会晚于实际到期。
+ * 每一层都要看，取最小的一个:上层的格子可能比下层的先到，
+ * 如now为0时加入64个tick的定时器(第1层)，推进到63之后再加入
+ * 63个tick的定时器(第0层，126到期)，下一个到期的是第1层的，
+ * 还有1个tick，而不是第0层的63
+ *
+ * @return 没有定时器时返回TIMER_WHEEL_MAX_TIMEOUT
+ */
+uint64_t timer_wheel_next_timeout(timer_wheel *w) {
+	uint64_t start, delta, best = TIMER_WHEEL_MAX_TIMEOUT;
+	int level, i, shift;
+
+	if (w->used == 0) return TIMER_WHEEL_MAX_TIMEOUT;
+
+	for (level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+		shift = TIMER_WHEEL_BITS * level;
+
+		for (i = 1; i <= TIMER_WHEEL_SLOTS; i++) {
+			start = ((w->now >> shift) + i) << shift;
+			if (timer_link_empty(&w->slots[level][(start >> shift) & TIMER_WHEEL_MASK])) continue;
+
+			delta = start - w->now;
+			if (delta == 0) delta = 1;
+			if (delta < best) best = delta;
+			break;
+		}
+	}
+
+	return best;
+}
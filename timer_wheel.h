@@ -0,0 +1,75 @@
+
+/**
+ * 分层时间轮
+ *
+ * 用于连接的空闲、keep-alive和linger超时。定时器嵌在连接中，
+ * 加入、取消都是O(1)，每个tick只处理到期的那一格，
+ * 不用每秒扫描所有连接
+ *
+ * 共TIMER_WHEEL_LEVELS层，每层TIMER_WHEEL_SLOTS格，第0层一格
+ * 为一个tick，上一层一格为下一层一整圈。上层的格子转到时，
+ * 其中的定时器按剩余时间下放到下层
+ */
+
+#ifndef _TIMER_WHEEL_H_
+#define _TIMER_WHEEL_H_
+
+#include "settings.h"
+
+#include <stdint.h>
+
+#define TIMER_WHEEL_BITS   6
+#define TIMER_WHEEL_SLOTS  (1 << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_MASK   (TIMER_WHEEL_SLOTS - 1)
+#define TIMER_WHEEL_LEVELS 4
+
+/**
+ * 能表示的最长超时，更长的按这个值处理
+ */
+#define TIMER_WHEEL_MAX_TIMEOUT (((uint64_t)1 << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS)) - 1)
+
+typedef struct timer_link {
+	struct timer_link *prev;
+	struct timer_link *next;
+} timer_link;
+
+struct timer_wheel;
+struct timer_node;
+
+/**
+ * 定时器到期时的回调
+ *
+ * 返回HANDLER_COMEBACK时以原来的超时重新加入，其它返回值
+ * 表示这个定时器结束了。回调中可以加入或取消任何定时器，
+ * 也可以释放t所在的连接(这时不能返回HANDLER_COMEBACK)
+ */
+typedef handler_t (*timer_cb)(struct timer_wheel *w, struct timer_node *t, void *ctx);
+
+typedef struct timer_node {
+	timer_link link;     /* 必须是第一个成员 */
+
+	uint64_t expires;    /* 到期的tick */
+	uint64_t timeout;    /* 加入时的超时，重新加入时使用 */
+	int armed;
+
+	timer_cb cb;
+	void *ctx;           /* 调用者的数据，一般为connection */
+} timer_node;
+
+typedef struct timer_wheel {
+	timer_link slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+
+	uint64_t now;        /* 已经处理到的tick */
+	size_t used;         /* 加入的定时器个数 */
+	uint64_t fired;      /* 统计，到期的定时器个数 */
+} timer_wheel;
+
+void timer_wheel_init(timer_wheel *w, uint64_t now);
+void timer_node_init(timer_node *t, timer_cb cb, void *ctx);
+
+void timer_wheel_arm(timer_wheel *w, timer_node *t, uint64_t timeout);
+void timer_wheel_cancel(timer_wheel *w, timer_node *t);
+size_t timer_wheel_advance(timer_wheel *w, uint64_t now);
+uint64_t timer_wheel_next_timeout(timer_wheel *w);
+
+#endif